@@ -0,0 +1,147 @@
+/*
+ * FramebufferScalerBenchmark.cpp - compares FramebufferScaler with QImage::scaled()
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <QtCore/QElapsedTimer>
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+
+#include "FramebufferScaler.h"
+
+
+enum {
+	Iterations = 20
+} ;
+
+
+// screen resolutions commonly found in computer labs
+static const QSize __resolutions[] = {
+	QSize( 1024, 768 ),
+	QSize( 1280, 1024 ),
+	QSize( 1366, 768 ),
+	QSize( 1600, 900 ),
+	QSize( 1920, 1080 ),
+	QSize( 1920, 1200 ),
+	QSize( 2560, 1440 )
+} ;
+
+// thumbnail widths used by the master with small and large tiles
+static const int __thumbnailWidths[] = { 160, 320, 640 } ;
+
+
+
+// something resembling a desktop - a gradient background with windows
+// containing text so both smooth and sharp edges are present
+static QImage syntheticDesktop( const QSize &size )
+{
+	QImage image( size, QImage::Format_RGB32 );
+
+	QLinearGradient gradient( 0, 0, size.width(), size.height() );
+	gradient.setColorAt( 0, QColor( 32, 64, 128 ) );
+	gradient.setColorAt( 1, QColor( 160, 192, 224 ) );
+
+	QPainter p( &image );
+	p.fillRect( image.rect(), gradient );
+
+	srand( size.width() * size.height() );
+	for( int i = 0; i < 12; ++i )
+	{
+		const QRect window( rand() % size.width(), rand() % size.height(),
+							size.width() / 3, size.height() / 3 );
+		p.fillRect( window, QColor( 240, 240, 240 ) );
+		p.fillRect( window.left(), window.top(), window.width(), 24,
+					QColor( rand() % 256, rand() % 256, rand() % 256 ) );
+		// glyph-like specks instead of real text so we don't need fonts and
+		// therefore no QGuiApplication
+		for( int y = window.top() + 32; y < window.bottom(); y += 16 )
+		{
+			for( int x = window.left() + 8; x < window.right(); x += 7 )
+			{
+				p.fillRect( x, y, 1 + rand() % 5, 2 + rand() % 8,
+							Qt::black );
+			}
+		}
+	}
+
+	return image;
+}
+
+
+
+template<class ScaleFunction>
+static double measure( ScaleFunction scale )
+{
+	// warm up caches and let implementation allocate its buffers once
+	QImage result = scale();
+
+	QElapsedTimer timer;
+	timer.start();
+	for( int i = 0; i < Iterations; ++i )
+	{
+		result = scale();
+	}
+
+	return timer.nsecsElapsed() / 1000000.0 / Iterations;
+}
+
+
+
+
+int main()
+{
+	printf( "FramebufferScaler implementation: %s\n",
+					FramebufferScaler::implementation() );
+	printf( "%-11s %-9s %14s %14s %8s\n", "source", "target",
+					"scaler [ms]", "smooth [ms]", "speedup" );
+
+	for( const QSize &resolution : __resolutions )
+	{
+		const QImage desktop = syntheticDesktop( resolution );
+
+		for( int width : __thumbnailWidths )
+		{
+			const QSize size = resolution.scaled( width, resolution.height(),
+													Qt::KeepAspectRatio );
+			if( FramebufferScaler::canScale( desktop, size ) == false )
+			{
+				continue;
+			}
+
+			const double scaler = measure( [&]() {
+				return FramebufferScaler::scaled( desktop, size ); } );
+			const double smooth = measure( [&]() {
+				return desktop.scaled( size, Qt::IgnoreAspectRatio,
+										Qt::SmoothTransformation ); } );
+
+			printf( "%5dx%-5d %4dx%-4d %14.3f %14.3f %7.2fx\n",
+					resolution.width(), resolution.height(),
+					size.width(), size.height(),
+					scaler, smooth, smooth / scaler );
+		}
+	}
+
+	return 0;
+}
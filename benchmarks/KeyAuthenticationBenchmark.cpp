@@ -0,0 +1,118 @@
+/*
+ * KeyAuthenticationBenchmark.cpp - measures key loading and signature checks
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <cstdio>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QTemporaryDir>
+
+#include "DsaKey.h"
+#include "PublicKeyCache.h"
+
+
+enum {
+	Iterations = 1000,
+	// size of keys generated by "imc -createkeypair"
+	KeyBits = 1024
+} ;
+
+
+
+// what ItalcCoreServer::doKeyBasedAuth() did before public keys were cached -
+// read and parse key file for every connecting client
+static bool verifyUncached( const QString &path, const QByteArray &challenge,
+							const QByteArray &signature )
+{
+	const PublicDSAKey key( path );
+	return key.verifySignature( challenge, signature );
+}
+
+
+
+// what ItalcCoreServer::publicKey() does now - the same cache is used
+static bool verifyCached( const QString &path, const QByteArray &challenge,
+							const QByteArray &signature )
+{
+	static PublicKeyCache cache;
+	return cache.key( path )->verifySignature( challenge, signature );
+}
+
+
+
+template<class VerifyFunction>
+static double measure( VerifyFunction verify, const QString &path,
+						const QByteArray &challenge,
+						const QByteArray &signature )
+{
+	QElapsedTimer timer;
+	timer.start();
+	for( int i = 0; i < Iterations; ++i )
+	{
+		if( verify( path, challenge, signature ) == false )
+		{
+			qCritical( "signature verification failed" );
+			return -1;
+		}
+	}
+
+	return timer.nsecsElapsed() / 1000.0 / Iterations;
+}
+
+
+
+
+int main()
+{
+	QTemporaryDir dir;
+	const QString path = dir.path() + "/key";
+
+	const PrivateDSAKey privateKey( KeyBits );
+	if( PublicDSAKey( privateKey ).save( path ) == false )
+	{
+		qCritical( "could not save public key" );
+		return 1;
+	}
+
+	// same challenge size as used by doKeyBasedAuth()
+	const QByteArray challenge = DsaKey::generateChallenge();
+	const QByteArray signature = privateKey.sign( challenge );
+
+	const double uncached = measure( verifyUncached, path,
+										challenge, signature );
+	const double cached = measure( verifyCached, path, challenge, signature );
+	if( uncached < 0 || cached < 0 )
+	{
+		return 1;
+	}
+
+	printf( "load + verify:  %9.1f us per client  %9.0f auths/s\n",
+				uncached, 1000000 / uncached );
+	printf( "cached verify:  %9.1f us per client  %9.0f auths/s\n",
+				cached, 1000000 / cached );
+	printf( "saved:          %9.1f us per client (%.1f%%)\n",
+				uncached - cached, 100 * ( uncached - cached ) / uncached );
+
+	return 0;
+}
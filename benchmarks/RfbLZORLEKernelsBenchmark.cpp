@@ -0,0 +1,269 @@
+/*
+ * RfbLZORLEKernelsBenchmark.cpp - compares implementations of LZORLE kernels
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QVector>
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+
+#include "RfbLZORLE.h"
+#include "RfbLZORLEKernels.h"
+
+#include "minilzo.h"
+
+#include <rfb/rfb.h>
+
+
+// usually defined by libvncserver which we do not link against
+#ifdef LIBVNCSERVER_WORDS_BIGENDIAN
+char rfbEndianTest = (1==0);
+#else
+char rfbEndianTest = (1==1);
+#endif
+
+
+enum {
+	Iterations = 20,
+	// same size as the tiles of the demo server
+	TileSize = 64
+} ;
+
+
+static const QSize __resolutions[] = {
+	QSize( 1366, 768 ),
+	QSize( 1920, 1080 ),
+	QSize( 2560, 1440 )
+} ;
+
+static const char *__implementations[] = { "scalar", "SSE2", "AVX2" } ;
+
+
+
+// solid background with windows containing text - i.e. mostly long runs
+// interrupted by lots of very short ones like on a real desktop
+static QImage syntheticDesktop( const QSize &size )
+{
+	QImage image( size, QImage::Format_RGB32 );
+	image.fill( QColor( 58, 110, 165 ) );
+
+	QPainter p( &image );
+
+	srand( size.width() * size.height() );
+	for( int i = 0; i < 12; ++i )
+	{
+		const QRect window( rand() % size.width(), rand() % size.height(),
+							size.width() / 3, size.height() / 3 );
+		p.fillRect( window, QColor( 240, 240, 240 ) );
+		p.fillRect( window.left(), window.top(), window.width(), 24,
+					QColor( rand() % 256, rand() % 256, rand() % 256 ) );
+		for( int y = window.top() + 32; y < window.bottom(); y += 16 )
+		{
+			for( int x = window.left() + 8; x < window.right(); x += 7 )
+			{
+				p.fillRect( x, y, 1 + rand() % 5, 2 + rand() % 8,
+							Qt::black );
+			}
+		}
+	}
+
+	return image;
+}
+
+
+
+static void encode( const QImage &image, QByteArray &out )
+{
+	out.clear();
+	for( int y = 0; y < image.height(); y += TileSize )
+	{
+		for( int x = 0; x < image.width(); x += TileSize )
+		{
+			RfbLZORLE::encodeRect( image, QRect( x, y, TileSize, TileSize ).
+												intersected( image.rect() ),
+									false, out );
+		}
+	}
+}
+
+
+
+// decodes rectangles like the LZORLE handler of the client does
+static bool decode( const QByteArray &in, QVector<uint32_t> &frameBuffer,
+					int width, int height )
+{
+	QVector<uint8_t> rle;
+
+	const char *data = in.constData();
+	const char *end = data + in.size();
+	while( data < end )
+	{
+		rfbFramebufferUpdateRectHeader rhdr;
+		memcpy( &rhdr, data, sizeof( rhdr ) );
+		data += sizeof( rhdr );
+
+		const QRect rect( Swap16IfLE( rhdr.r.x ), Swap16IfLE( rhdr.r.y ),
+							Swap16IfLE( rhdr.r.w ), Swap16IfLE( rhdr.r.h ) );
+
+		RfbLZORLE::Header hdr;
+		memcpy( &hdr, data, sizeof( hdr ) );
+		data += sizeof( hdr );
+
+		if( !hdr.compressed )
+		{
+			for( int y = rect.top(); y <= rect.bottom(); ++y )
+			{
+				memcpy( frameBuffer.data() + y * width + rect.x(), data,
+							rect.width() * 4 );
+				data += rect.width() * 4;
+			}
+			continue;
+		}
+
+		hdr.bytesLZO = Swap32IfLE( hdr.bytesLZO );
+		hdr.bytesRLE = Swap32IfLE( hdr.bytesRLE );
+		rle.resize( hdr.bytesRLE );
+
+		lzo_uint bytesRLE = hdr.bytesRLE;
+		lzo1x_decompress_safe( (const unsigned char *) data, hdr.bytesLZO,
+								rle.data(), &bytesRLE, NULL );
+		if( bytesRLE != hdr.bytesRLE )
+		{
+			return false;
+		}
+		data += hdr.bytesLZO;
+
+		RfbLZORLE::expandRuns( rle.constData(), hdr.bytesRLE, false, rect,
+								frameBuffer.data(), width, height );
+	}
+
+	return data == end;
+}
+
+
+
+static bool matches( const QImage &image, const QVector<uint32_t> &frameBuffer )
+{
+	for( int y = 0; y < image.height(); ++y )
+	{
+		const uint32_t *src = (const uint32_t *) image.scanLine( y );
+		const uint32_t *dst = frameBuffer.constData() + y * image.width();
+		for( int x = 0; x < image.width(); ++x )
+		{
+			// alpha channel is not transferred
+			if( ( src[x] ^ dst[x] ) & 0xffffff )
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+
+
+int main()
+{
+	lzo_init();
+
+	printf( "%-11s %-8s %12s %12s %10s\n", "desktop", "kernels",
+					"encode [ms]", "decode [ms]", "size [kB]" );
+
+	for( const QSize &resolution : __resolutions )
+	{
+		const QImage desktop = syntheticDesktop( resolution );
+
+		QByteArray reference;
+		QVector<uint32_t> referenceFrameBuffer;
+
+		for( const char *implementation : __implementations )
+		{
+			if( RfbLZORLEKernels::selectImplementation( implementation ) ==
+																		false )
+			{
+				printf( "%5dx%-5d %-8s not supported by this CPU\n",
+						resolution.width(), resolution.height(),
+						implementation );
+				continue;
+			}
+
+			QByteArray encoded;
+			encode( desktop, encoded );
+
+			QElapsedTimer timer;
+			timer.start();
+			for( int i = 0; i < Iterations; ++i )
+			{
+				encode( desktop, encoded );
+			}
+			const double encodeTime =
+						timer.nsecsElapsed() / 1000000.0 / Iterations;
+
+			QVector<uint32_t> frameBuffer( resolution.width() *
+											resolution.height() );
+			timer.restart();
+			for( int i = 0; i < Iterations; ++i )
+			{
+				if( decode( encoded, frameBuffer, resolution.width(),
+										resolution.height() ) == false )
+				{
+					qCritical( "%s: could not decode data", implementation );
+					return 1;
+				}
+			}
+			const double decodeTime =
+						timer.nsecsElapsed() / 1000000.0 / Iterations;
+
+			printf( "%5dx%-5d %-8s %12.3f %12.3f %10.1f\n",
+					resolution.width(), resolution.height(), implementation,
+					encodeTime, decodeTime, encoded.size() / 1024.0 );
+
+			// all implementations have to produce exactly the same data
+			if( matches( desktop, frameBuffer ) == false )
+			{
+				qCritical( "%s: decoded framebuffer differs from desktop",
+							implementation );
+				return 1;
+			}
+			if( reference.isEmpty() )
+			{
+				reference = encoded;
+				referenceFrameBuffer = frameBuffer;
+			}
+			else if( encoded != reference ||
+						frameBuffer != referenceFrameBuffer )
+			{
+				qCritical( "%s: output differs from %s kernels",
+							implementation, __implementations[0] );
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
@@ -23,7 +23,10 @@
  *
  */
 
-#include <QtCore/QDateTime>
+#include <italcconfig.h>
+
+#include <QtCore/QDataStream>
+#include <QtCore/QRunnable>
 #include <QtNetwork/QTcpSocket>
 #include <QtCore/QTimer>
 #include <QtGui/QCursor>
@@ -31,32 +34,35 @@
 #include "DemoServer.h"
 #include "ItalcCoreServer.h"
 #include "ItalcVncConnection.h"
-#include "RfbLZORLE.h"
 #include "RfbItalcCursor.h"
+#include "RfbLZORLE.h"
 #include "SocketDevice.h"
 
-#include "minilzo.h"
 #include "rfb/rfb.h"
 
+#ifdef ITALC_BUILD_LINUX
+#include <sys/ioctl.h>
+#endif
+
 const int CURSOR_UPDATE_TIME = 35;
+const int HANDSHAKE_TIMEOUT = 5000;
 
 
+// only used during handshake where we're running in a thread of
+// DemoServer's handshake pool and therefore may block
 static qint64 qtcpsocketDispatcher( char * buffer, const qint64 bytes,
 									const SocketOpCodes opCode, void * user )
 {
 	QTcpSocket * sock = static_cast<QTcpSocket *>( user );
 	qint64 ret = 0;
 
-	QTime opStartTime;
-	opStartTime.start();
-
 	switch( opCode )
 	{
 		case SocketRead:
 			while( ret < bytes )
 			{
 				qint64 bytesRead = sock->read( buffer+ret, bytes-ret );
-				if( bytesRead < 0 || opStartTime.elapsed() > 5000 )
+				if( bytesRead < 0 )
 				{
 					qWarning( "qtcpsocketDispatcher(...): connection closed while reading" );
 					return 0;
@@ -69,47 +75,44 @@ static qint64 qtcpsocketDispatcher( char * buffer, const qint64 bytes,
 									"state:%d  error:%d", sock->state(), sock->error() );
 						return 0;
 					}
-					sock->waitForReadyRead( 10 );
+					if( sock->waitForReadyRead( HANDSHAKE_TIMEOUT ) == false )
+					{
+						qWarning( "qtcpsocketDispatcher(...): timeout while reading" );
+						return 0;
+					}
 				}
 				else
 				{
 					ret += bytesRead;
-					opStartTime.restart();
 				}
 			}
 			break;
 
 		case SocketWrite:
-			while( ret < bytes )
+			ret = sock->write( buffer, bytes );
+			if( ret < bytes )
 			{
-				qint64 written = sock->write( buffer+ret, bytes-ret );
-				if( written < 0 || opStartTime.elapsed() > 5000 )
+				qWarning( "qtcpsocketDispatcher(...): connection closed while writing" );
+				return 0;
+			}
+			while( sock->bytesToWrite() > 0 )
+			{
+				if( sock->waitForBytesWritten( HANDSHAKE_TIMEOUT ) == false )
 				{
-					qWarning( "qtcpsocketDispatcher(...): connection closed while writing" );
+					qWarning( "qtcpsocketDispatcher(...): connection failed while writing  "
+								"state:%d error:%d", sock->state(), sock->error() );
 					return 0;
 				}
-				else if( written == 0 )
-				{
-					if( sock->state() != QTcpSocket::ConnectedState )
-					{
-						qWarning( "qtcpsocketDispatcher(...): connection failed while writing  "
-									"state:%d error:%d", sock->state(), sock->error() );
-						return 0;
-					}
-				}
-				else
-				{
-					ret += written;
-					opStartTime.restart();
-				}
 			}
-			//sock->flush();
 			break;
 
 		case SocketGetPeerAddress:
 			strncpy( buffer,
 		sock->peerAddress().toString().toUtf8().constData(), bytes );
 			break;
+
+		default:
+			break;
 	}
 
 	return ret;
@@ -118,9 +121,148 @@ static qint64 qtcpsocketDispatcher( char * buffer, const qint64 bytes,
 
 
 
-DemoServer::DemoServer( int srcPort, int dstPort, QObject *parent ) :
+// performs RFB protocol initialization and authentication for a new
+// connection and hands it over to one of DemoServer's event loops
+class DemoServerHandshake : public QRunnable
+{
+public:
+	DemoServerHandshake( qintptr sock, const ItalcVncConnection *vncConn,
+							DemoServer *demoServer ) :
+		QRunnable(),
+		m_socketDescriptor( sock ),
+		m_vncConn( vncConn ),
+		m_demoServer( demoServer )
+	{
+		setAutoDelete( true );
+	}
+
+	virtual void run()
+	{
+		QTcpSocket *sock = new QTcpSocket;
+		if( !sock->setSocketDescriptor( m_socketDescriptor ) )
+		{
+			qCritical( "DemoServerHandshake::run(): "
+					"could not set socket-descriptor - aborting" );
+			delete sock;
+			return;
+		}
+
+		if( handshake( sock ) == false )
+		{
+			delete sock;
+			return;
+		}
+
+		// the client object and its socket are created here but are
+		// going to live in the event loop thread from now on
+		DemoServerClient *client =
+					new DemoServerClient( sock, m_vncConn, m_demoServer );
+		client->moveToThread( m_demoServer->nextEventLoop() );
+		QMetaObject::invokeMethod( client, "start", Qt::QueuedConnection );
+	}
+
+
+private:
+	bool handshake( QTcpSocket *sock )
+	{
+		SocketDevice sd( qtcpsocketDispatcher, sock );
+
+		rfbProtocolVersionMsg pv;
+		sprintf( pv, rfbProtocolVersionFormat, rfbProtocolMajorVersion,
+												rfbProtocolMinorVersion );
+
+		sd.write( pv, sz_rfbProtocolVersionMsg );
+		sd.read( pv, sz_rfbProtocolVersionMsg );
+
+		const uint8_t secTypeList[2] = { 1, rfbSecTypeItalc } ;
+		sd.write( (const char *) secTypeList, sizeof( secTypeList ) );
+
+		uint8_t chosen = 0;
+		sd.read( (char *) &chosen, sizeof( chosen ) );
+
+		if( chosen != rfbSecTypeItalc )
+		{
+			qCritical( "DemoServerHandshake::handshake(): "
+						"protocol initialization failed" );
+			return false;
+		}
+
+		uint32_t authResult = Swap32IfLE(rfbVncAuthFailed);
+
+		if( ItalcCoreServer::instance()->
+				authSecTypeItalc( qtcpsocketDispatcher, sock ) != true )
+		{
+			qWarning("auth of demo client failed\n");
+			return false;
+		}
+
+		authResult = Swap32IfLE(rfbVncAuthOK);
+
+		sd.write( (char *) &authResult, sizeof( authResult ) );
+
+		rfbClientInitMsg ci;
+
+		if( !sd.read( (char *) &ci, sz_rfbClientInitMsg ) )
+		{
+			qWarning( "failed reading rfbClientInitMsg" );
+			return false;
+		}
+
+		rfbServerInitMsg si;
+		if( m_demoServer->usesSharedFramebuffer() )
+		{
+			// shared framebuffer always is in QImage::Format_RGB32
+			const QSize s = m_demoServer->framebufferSize();
+			memset( &si, 0, sizeof( si ) );
+			si.framebufferWidth = s.width();
+			si.framebufferHeight = s.height();
+			si.format.bitsPerPixel = 32;
+			si.format.depth = 24;
+			si.format.trueColour = 1;
+			si.format.redMax = si.format.greenMax = si.format.blueMax = 255;
+			si.format.redShift = 16;
+			si.format.greenShift = 8;
+			si.format.blueShift = 0;
+		}
+		else
+		{
+			si = m_vncConn->getRfbClient()->si;
+		}
+		si.framebufferWidth = Swap16IfLE( si.framebufferWidth );
+		si.framebufferHeight = Swap16IfLE( si.framebufferHeight );
+		si.format.redMax = Swap16IfLE( si.format.redMax );
+		si.format.greenMax = Swap16IfLE( si.format.greenMax );
+		si.format.blueMax = Swap16IfLE( si.format.blueMax );
+		si.format.bigEndian = ( QSysInfo::ByteOrder == QSysInfo::BigEndian )
+										? 1 : 0;
+		si.nameLength = 0;
+		if( !sd.write( ( const char *) &si, sz_rfbServerInitMsg ) )
+		{
+			qWarning( "failed writing rfbServerInitMsg" );
+			return false;
+		}
+
+		return true;
+	}
+
+	const qintptr m_socketDescriptor;
+	const ItalcVncConnection *m_vncConn;
+	DemoServer *m_demoServer;
+
+} ;
+
+
+
+
+DemoServer::DemoServer( int srcPort, int dstPort,
+						const QString &sharedFramebuffer, QObject *parent ) :
 	QTcpServer( parent ),
-	m_vncConn()
+	m_vncConn(),
+	m_sharedFramebuffer(),
+	m_encoder(),
+	m_handshakePool(),
+	m_eventLoops(),
+	m_nextEventLoop( 0 )
 {
 	if( listen( QHostAddress::Any, dstPort ) == false )
 	{
@@ -129,11 +271,47 @@ DemoServer::DemoServer( int srcPort, int dstPort, QObject *parent ) :
 		return;
 	}
 
-	m_vncConn.setHost( QHostAddress( QHostAddress::LocalHost ).toString() );
-	m_vncConn.setPort( srcPort );
-	m_vncConn.setItalcAuthType( ItalcAuthCommonSecret );
-	m_vncConn.setQuality( ItalcVncConnection::DemoServerQuality );
-	m_vncConn.start();
+	m_handshakePool.setMaxThreadCount( MaxHandshakeThreads );
+
+	const int eventLoopCount =
+				qBound<int>( 1, QThread::idealThreadCount() / 2, MaxEventLoops );
+	for( int i = 0; i < eventLoopCount; ++i )
+	{
+		QThread *eventLoop = new QThread( this );
+		eventLoop->start();
+		m_eventLoops += eventLoop;
+	}
+
+	// the cache has to be invalidated before framebufferUpdated() is
+	// emitted so the slots are connected directly
+	if( m_sharedFramebuffer.open( sharedFramebuffer ) )
+	{
+		connect( &m_sharedFramebuffer, SIGNAL( imageUpdated( int, int, int, int ) ),
+					this, SLOT( invalidateEncodedRect( int, int, int, int ) ),
+								Qt::DirectConnection );
+		connect( &m_sharedFramebuffer, SIGNAL( framebufferSizeChanged( int, int ) ),
+					this, SLOT( invalidateEncodedFramebuffer() ),
+								Qt::DirectConnection );
+	}
+	else
+	{
+		qWarning( "DemoServer::DemoServer(): shared framebuffer not "
+					"available, falling back to VNC connection" );
+
+		m_vncConn.setHost( QHostAddress( QHostAddress::LocalHost ).toString() );
+		m_vncConn.setPort( srcPort );
+		m_vncConn.setItalcAuthType( ItalcAuthCommonSecret );
+		m_vncConn.setQuality( ItalcVncConnection::DemoServerQuality );
+
+		connect( &m_vncConn, SIGNAL( imageUpdated( int, int, int, int ) ),
+					this, SLOT( invalidateEncodedRect( int, int, int, int ) ),
+								Qt::DirectConnection );
+		connect( &m_vncConn, SIGNAL( framebufferSizeChanged( int, int ) ),
+					this, SLOT( invalidateEncodedFramebuffer() ),
+								Qt::DirectConnection );
+
+		m_vncConn.start();
+	}
 
 	connect( &m_vncConn, SIGNAL( cursorShapeUpdated( const QImage &, int, int ) ),
 				this, SLOT( updateInitialCursorShape( const QImage &, int, int ) ) );
@@ -145,16 +323,33 @@ DemoServer::DemoServer( int srcPort, int dstPort, QObject *parent ) :
 
 DemoServer::~DemoServer()
 {
-	QList<DemoServerClient *> l;
-	while( !( l = findChildren<DemoServerClient *>() ).isEmpty() )
+	close();
+
+	// no more clients are handed over to event loops after this
+	m_handshakePool.waitForDone();
+
+	// clients are deleted by their event loop thread when it finishes
+	for( QThread *eventLoop : m_eventLoops )
 	{
-		delete l.front();
+		eventLoop->quit();
+		eventLoop->wait();
+		delete eventLoop;
 	}
 }
 
 
 
 
+QThread *DemoServer::nextEventLoop()
+{
+	const int i = m_nextEventLoop.fetchAndAddOrdered( 1 );
+
+	return m_eventLoops[( i & 0x7fffffff ) % m_eventLoops.size()];
+}
+
+
+
+
 void DemoServer::checkForCursorMovement()
 {
 return;	// TODO
@@ -182,41 +377,63 @@ return;	// TODO
 
 
 
-void DemoServer::incomingConnection( int sock )
+void DemoServer::invalidateEncodedRect( int x, int y, int w, int h )
 {
-	new DemoServerClient( sock, &m_vncConn, this );
+	m_encoder.invalidate( QRect( x, y, w, h ) );
+
+	emit framebufferUpdated( x, y, w, h );
 }
 
 
 
 
-#define RAW_MAX_PIXELS 1024
+void DemoServer::invalidateEncodedFramebuffer()
+{
+	m_encoder.invalidateAll();
+}
+
+
+
+
+void DemoServer::incomingConnection( qintptr sock )
+{
+	m_handshakePool.start( new DemoServerHandshake( sock, &m_vncConn, this ) );
+}
+
+
 
-DemoServerClient::DemoServerClient( int sock, const ItalcVncConnection *vncConn,
+
+DemoServerClient::DemoServerClient( QTcpSocket *sock,
+										const ItalcVncConnection *vncConn,
 										DemoServer *parent ) :
-	QThread( parent ),
+	QObject(),
 	m_demoServer( parent ),
-	m_dataMutex( QMutex::Recursive ),
 	m_updatesPending( false ),
-	m_changedRects(),
+	m_changedRegion(),
 	m_cursorHotX( 0 ),
 	m_cursorHotY( 0 ),
 	m_cursorShapeChanged( false ),
-	m_socketDescriptor( sock ),
-	m_sock( NULL ),
+	m_sock( sock ),
 	m_vncConn( vncConn ),
 	m_otherEndianess( false ),
-	m_lzoWorkMem( new char[sizeof( lzo_align_t ) *
-			( ( ( LZO1X_1_MEM_COMPRESS ) +
-					( sizeof( lzo_align_t ) - 1 ) ) /
-						sizeof( lzo_align_t ) ) ] ),
-	m_rawBuf( new QRgb[RAW_MAX_PIXELS] ),
-	m_rleBuf( NULL ),
-	m_currentRleBufSize( 0 ),
-	m_lzoOutBuf( NULL ),
-	m_currentLzoOutBufSize( 0 )
+	m_deltaEncoding( false ),
+	m_tileGenerations(),
+	m_outgoingQueue(),
+	m_sendTimer( this ),
+	m_backlogTimer( this ),
+	m_lastFrameTimer(),
+	m_lastFrameDrained( true )
 {
-	start();
+	m_sock->setParent( this );
+
+	m_sendTimer.setSingleShot( true );
+	connect( &m_sendTimer, SIGNAL( timeout() ), this, SLOT( sendUpdates() ) );
+
+	// the OS does not tell us when the client acknowledged data so we
+	// have to check on our own
+	m_backlogTimer.setSingleShot( true );
+	connect( &m_backlogTimer, SIGNAL( timeout() ),
+				this, SLOT( flushOutgoingQueue() ) );
 }
 
 
@@ -224,19 +441,45 @@ DemoServerClient::DemoServerClient( int sock, const ItalcVncConnection *vncConn,
 
 DemoServerClient::~DemoServerClient()
 {
-	exit();
-	wait();
+}
 
-	if( m_lzoOutBuf )
-	{
-		delete[] m_lzoOutBuf;
-	}
-	if( m_rleBuf )
-	{
-		delete[] m_rleBuf;
-	}
-	delete[] m_lzoWorkMem;
-	delete[] m_rawBuf;
+
+
+
+void DemoServerClient::start()
+{
+	// we're deleted as soon as the event loop we're living in finishes
+	connect( thread(), SIGNAL( finished() ), this, SLOT( deleteLater() ) );
+
+	connect( m_vncConn, SIGNAL( cursorShapeUpdated( const QImage &, int, int ) ),
+			this, SLOT( updateCursorShape( const QImage &, int, int ) ),
+							Qt::QueuedConnection );
+	connect( m_demoServer, SIGNAL( framebufferUpdated( int, int, int, int ) ),
+			this, SLOT( updateRect( int, int, int, int ) ),
+							Qt::QueuedConnection );
+
+	// TODO
+	//updateCursorShape( m_demoServer->initialCursorShape(), 0, 0 );
+
+	// first time send a key-frame
+	QSize s = m_demoServer->framebufferSize();
+	updateRect( 0, 0, s.width(), s.height() );
+
+	connect( m_sock, SIGNAL( readyRead() ),
+				this, SLOT( processClient() ) );
+	connect( m_sock, SIGNAL( bytesWritten( qint64 ) ),
+				this, SLOT( flushOutgoingQueue() ) );
+	connect( m_sock, SIGNAL( disconnected() ),
+				this, SLOT( deleteLater() ) );
+
+	// TODO
+/*	QTimer *t = new QTimer( this );
+	connect( t, SIGNAL( timeout() ), this, SLOT( moveCursor() ) );
+	t->start( CURSOR_UPDATE_TIME );*/
+
+	// the client might have sent its first update request while the
+	// connection has been handed over to us
+	processClient();
 }
 
 
@@ -244,9 +487,13 @@ DemoServerClient::~DemoServerClient()
 
 void DemoServerClient::updateRect( int x, int y, int w, int h )
 {
-	m_dataMutex.lock();
-	m_changedRects += QRect( x, y, w, h );
-	m_dataMutex.unlock();
+	// changes are merged into a single region so they do not pile up
+	// while a slow client is still busy with previous updates
+	m_changedRegion += QRect( x, y, w, h );
+	if( m_changedRegion.rectCount() > MaxChangedRects )
+	{
+		m_changedRegion = m_changedRegion.boundingRect();
+	}
 }
 
 
@@ -255,12 +502,10 @@ void DemoServerClient::updateRect( int x, int y, int w, int h )
 void DemoServerClient::updateCursorShape( const QImage &img, int x, int y )
 {
 return;		// TODO
-	m_dataMutex.lock();
 	m_cursorShape = img;
 	m_cursorHotX = x;
 	m_cursorHotY = y;
 	m_cursorShapeChanged = true;
-	m_dataMutex.unlock();
 }
 
 
@@ -272,7 +517,6 @@ return;		// TODO
 	QPoint p = m_demoServer->cursorPos();
 	if( p != m_lastCursorPos )
 	{
-		m_dataMutex.lock();
 		m_lastCursorPos = p;
 		const rfbFramebufferUpdateMsg m =
 		{
@@ -281,8 +525,6 @@ return;		// TODO
 			(uint16_t) Swap16IfLE( 1 )
 		} ;
 
-		m_sock->write( (const char *) &m, sizeof( m ) );
-
 		const rfbRectangle rr =
 		{
 			(uint16_t) Swap16IfLE( m_lastCursorPos.x() ),
@@ -297,9 +539,8 @@ return;		// TODO
 			Swap32IfLE( rfbEncodingPointerPos )
 		} ;
 
-		m_sock->write( (const char *) &rh, sizeof( rh ) );
-		m_sock->flush();
-		m_dataMutex.unlock();
+		enqueue( QByteArray( (const char *) &m, sizeof( m ) ) +
+					QByteArray( (const char *) &rh, sizeof( rh ) ) );
 	}
 }
 
@@ -308,169 +549,59 @@ return;		// TODO
 
 void DemoServerClient::sendUpdates()
 {
-	QMutexLocker ml( &m_dataMutex );
-
-	if( m_changedRects.isEmpty() && m_cursorShapeChanged == false )
+	if( m_changedRegion.isEmpty() && m_cursorShapeChanged == false )
 	{
 		if( m_updatesPending )
 		{
-			QTimer::singleShot( 50, this, SLOT( sendUpdates() ) );
+			scheduleUpdate( 50 );
 		}
 		return;
 	}
 
-	// extract single (non-overlapping) rects out of changed region
-	// this way we avoid lot of simliar/overlapping rectangles,
-	// e.g. if we didn't get an update-request for a quite long time
-	// and there were a lot of updates - at the end we don't send
-	// more than the whole screen one time
-	QRegion region;
-	for( auto rect : m_changedRects )
+	// skip this frame if client did not even receive the previous one -
+	// changes are coalesced in m_changedRegion and sent as soon as the
+	// outgoing queue is drained (see flushOutgoingQueue())
+	if( hasBacklog() )
+	{
+		return;
+	}
+
+	const int delay = frameDelay();
+	if( delay > 0 )
 	{
-		region += rect;
+		scheduleUpdate( delay );
+		return;
 	}
-	QVector<QRect> r = region.rects();
+
+	// frame interval includes the time needed for encoding
+	m_lastFrameTimer.start();
+
+	// encode all tiles of changed region in parallel - the region
+	// consists of single non-overlapping rects so even if we didn't get
+	// an update-request for a quite long time we don't send more than
+	// the whole screen one time
+	const QList<QByteArray> tiles =
+		m_demoServer->encoder().encode( m_demoServer->framebuffer(), m_changedRegion,
+										m_otherEndianess,
+										m_deltaEncoding ? &m_tileGenerations : NULL );
+
+	m_lastFrameDrained = false;
 
 	// no we gonna post all changed rects!
 	const rfbFramebufferUpdateMsg m =
 	{
 		rfbFramebufferUpdate,
 		0,
-		(uint16_t) Swap16IfLE( r.size() +
+		(uint16_t) Swap16IfLE( tiles.size() +
 				( m_cursorShapeChanged ? 1 : 0 ) )
 	} ;
 
-	SocketDevice sd( qtcpsocketDispatcher, m_sock );
-	sd.write( (const char *) &m, sz_rfbFramebufferUpdateMsg );
+	enqueue( QByteArray( (const char *) &m, sz_rfbFramebufferUpdateMsg ) );
 
-	// process each rect
-	for( QVector<QRect>::ConstIterator it = r.begin(); it != r.end(); ++it )
+	// tiles are shared with other clients so queueing them does not copy
+	for( const QByteArray &tile : tiles )
 	{
-		const int rx = it->x();
-		const int ry = it->y();
-		const int rw = it->width();
-		const int rh = it->height();
-		const rfbRectangle rr =
-		{
-			(uint16_t) Swap16IfLE( rx ),
-			(uint16_t) Swap16IfLE( ry ),
-			(uint16_t) Swap16IfLE( rw ),
-			(uint16_t) Swap16IfLE( rh )
-		} ;
-
-		const rfbFramebufferUpdateRectHeader rhdr =
-		{
-			rr,
-			(uint32_t) Swap32IfLE( rfbEncodingLZORLE )
-		} ;
-
-		sd.write( (const char *) &rhdr, sizeof( rhdr ) );
-
-		const QImage & i = m_vncConn->image();
-		RfbLZORLE::Header hdr = { 0, 0, 0 } ;
-
-		// we only compress if it's enough data, otherwise
-		// there's too much overhead
-		if( rw * rh > RAW_MAX_PIXELS )
-		{
-
-	hdr.compressed = 1;
-	QRgb last_pix = *( (QRgb *) i.scanLine( ry ) + rx );
-
-	// re-allocate RLE buffer if current one is too small
-	const size_t rleBufSize = rw * rh * sizeof( QRgb )+16;
-	if( rleBufSize > m_currentRleBufSize )
-	{
-		if( m_rleBuf )
-		{
-			delete[] m_rleBuf;
-		}
-		m_rleBuf = new uint8_t[rleBufSize];
-		m_currentRleBufSize = rleBufSize;
-	}
-
-	uint8_t rle_cnt = 0;
-	uint8_t rle_sub = 1;
-	uint8_t *out = m_rleBuf;
-	uint8_t *out_ptr = out;
-	for( int y = ry; y < ry+rh; ++y )
-	{
-		const QRgb * data = ( (const QRgb *) i.scanLine( y ) ) + rx;
-		for( int x = 0; x < rw; ++x )
-		{
-			if( data[x] != last_pix || rle_cnt > 254 )
-			{
-				*( (QRgb *) out_ptr ) = Swap32IfBE( last_pix );
-				*( out_ptr + 3 ) = rle_cnt - rle_sub;
-				out_ptr += 4;
-				last_pix = data[x];
-				rle_cnt = rle_sub = 0;
-			}
-			else
-			{
-				++rle_cnt;
-			}
-		}
-	}
-
-	// flush RLE-loop
-	*( (QRgb *) out_ptr ) = last_pix;
-	*( out_ptr + 3 ) = rle_cnt;
-	out_ptr += 4;
-	hdr.bytesRLE = out_ptr - out;
-
-	lzo_uint bytes_lzo = hdr.bytesRLE + hdr.bytesRLE / 16 + 67;
-
-	// re-allocate LZO output buffer if current one is too small
-	if( bytes_lzo > m_currentLzoOutBufSize )
-	{
-		if( m_lzoOutBuf )
-		{
-			delete[] m_lzoOutBuf;
-		}
-		m_lzoOutBuf = new uint8_t[bytes_lzo];
-		m_currentLzoOutBufSize = bytes_lzo;
-	}
-
-	uint8_t *comp = m_lzoOutBuf;
-	lzo1x_1_compress( (const unsigned char *) out, (lzo_uint) hdr.bytesRLE,
-				(unsigned char *) comp,
-				&bytes_lzo, m_lzoWorkMem );
-	hdr.bytesRLE = Swap32IfLE( hdr.bytesRLE );
-	hdr.bytesLZO = Swap32IfLE( bytes_lzo );
-
-	sd.write( (const char *) &hdr, sizeof( hdr ) );
-	sd.write( (const char *) comp, Swap32IfLE( hdr.bytesLZO ) );
-
-		}
-		else
-		{
-			sd.write( (const char *) &hdr, sizeof( hdr ) );
-			QRgb *dst = m_rawBuf;
-			if( m_otherEndianess )
-			{
-				for( int y = 0; y < rh; ++y )
-				{
-					const QRgb *src = (const QRgb *) i.scanLine( ry + y ) + rx;
-					for( int x = 0; x < rw; ++x, ++src, ++dst )
-					{
-						*dst = Swap32( *src );
-					}
-				}
-			}
-			else
-			{
-				for( int y = 0; y < rh; ++y )
-				{
-					const QRgb *src = (const QRgb *) i.scanLine( ry + y ) + rx;
-					for( int x = 0; x < rw; ++x, ++src, ++dst )
-					{
-						*dst = *src;
-					}
-				}
-			}
-			sd.write( (const char *) m_rawBuf, rh * rw * sizeof( QRgb ) );
-		}
+		enqueue( tile );
 	}
 
 	if( m_cursorShapeChanged )
@@ -490,20 +621,22 @@ void DemoServerClient::sendUpdates()
 			(uint32_t) Swap32IfLE( rfbEncodingItalcCursor )
 		} ;
 
-		sd.write( (const char *) &rh, sizeof( rh ) );
+		QByteArray cursorData;
+		QDataStream ds( &cursorData, QIODevice::WriteOnly );
+		ds << QVariant::fromValue( cur );
 
-		sd.write( QVariant::fromValue( cur ) );
+		enqueue( QByteArray( (const char *) &rh, sizeof( rh ) ) + cursorData );
 	}
 
 	// reset vars
-	m_changedRects.clear();
+	m_changedRegion = QRegion();
 	m_cursorShapeChanged = false;
 
 	if( m_updatesPending )
 	{
 		// make sure to send an update once more even if there has
 		// been no update request
-		QTimer::singleShot( 1000, this, SLOT( sendUpdates() ) );
+		scheduleUpdate( 1000 );
 	}
 
 	m_updatesPending = false;
@@ -511,185 +644,208 @@ void DemoServerClient::sendUpdates()
 
 
 
-void DemoServerClient::processClient()
-{
-	SocketDevice sd( qtcpsocketDispatcher, m_sock );
 
-	m_dataMutex.lock();
-	while( m_sock->bytesAvailable() > 0 )
+void DemoServerClient::flushOutgoingQueue()
+{
+	while( m_outgoingQueue.isEmpty() == false &&
+			m_sock->bytesToWrite() < MaxSocketBufferSize )
 	{
-		rfbClientToServerMsg msg;
-		if( sd.read( (char *) &msg, 1 ) <= 0 )
+		const QByteArray data = m_outgoingQueue.takeFirst();
+		if( m_sock->write( data ) != data.size() )
 		{
-			qWarning( "DemoServerClient::processClient(): "
-							"could not read cmd" );
-			continue;
-		}
-
-		switch( msg.type )
-		{
-			case rfbSetEncodings:
-				sd.read( ((char *)&msg)+1, sz_rfbSetEncodingsMsg-1 );
-				msg.se.nEncodings = Swap16IfLE(msg.se.nEncodings);
-				for( int i = 0; i < msg.se.nEncodings; ++i )
-				{
-					uint32_t enc;
-					sd.read( (char *) &enc, 4 );
-				}
-				continue;
-
-			case rfbSetPixelFormat:
-				sd.read( ((char *) &msg)+1, sz_rfbSetPixelFormatMsg-1 );
-				continue;
-			case rfbSetServerInput:
-				sd.read( ((char *) &msg)+1, sz_rfbSetServerInputMsg-1 );
-				continue;
-			case rfbClientCutText:
-				sd.read( ((char *) &msg)+1, sz_rfbClientCutTextMsg-1 );
-				msg.cct.length = Swap32IfLE( msg.cct.length );
-				if( msg.cct.length )
-				{
-					char *t = new char[msg.cct.length];
-					sd.read( t, msg.cct.length );
-					delete[] t;
-				}
-				continue;
-			case rfbFramebufferUpdateRequest:
-				sd.read( ((char *) &msg)+1, sz_rfbFramebufferUpdateRequestMsg-1 );
-				m_updatesPending = true;
-				break;
-			default:
-				qWarning( "DemoServerClient::processClient(): "
-							"ignoring msg type %d", msg.type );
-				continue;
+			qWarning( "DemoServerClient::flushOutgoingQueue(): "
+						"connection closed while writing" );
+			m_outgoingQueue.clear();
+			m_sock->abort();
+			return;
 		}
+	}
 
+	if( m_lastFrameDrained )
+	{
+		return;
 	}
 
-	if( m_updatesPending )
+	if( hasBacklog() )
 	{
-		sendUpdates();
+		// no more bytesWritten() signals once Qt passed everything to the
+		// OS so keep an eye on the data still on its way to the client
+		if( m_outgoingQueue.isEmpty() && m_sock->bytesToWrite() == 0 )
+		{
+			m_backlogTimer.start( BacklogPollInterval );
+		}
 	}
+	else
+	{
+		m_lastFrameDrained = true;
 
-	m_dataMutex.unlock();
+		// send changes which accumulated during transfer if the client
+		// asked for them meanwhile
+		if( m_updatesPending &&
+				( m_changedRegion.isEmpty() == false || m_cursorShapeChanged ) )
+		{
+			scheduleUpdate( frameDelay() );
+		}
+	}
 }
 
 
 
 
-void DemoServerClient::run()
+void DemoServerClient::scheduleUpdate( int msecs )
 {
-	QMutexLocker ml( &m_dataMutex );
-
-	QTcpSocket sock;
-	m_sock = &sock;
-	if( !m_sock->setSocketDescriptor( m_socketDescriptor ) )
+	if( m_sendTimer.isActive() == false || m_sendTimer.remainingTime() > msecs )
 	{
-		qCritical( "DemoServerClient::run(): "
-				"could not set socket-descriptor - aborting" );
-		deleteLater();
-		return;
+		m_sendTimer.start( msecs );
 	}
+}
 
-	SocketDevice sd( qtcpsocketDispatcher, m_sock );
-
-	rfbProtocolVersionMsg pv;
-	sprintf( pv, rfbProtocolVersionFormat, rfbProtocolMajorVersion,
-											rfbProtocolMinorVersion );
-
-	sd.write( pv, sz_rfbProtocolVersionMsg );
-	sd.read( pv, sz_rfbProtocolVersionMsg );
 
-	const uint8_t secTypeList[2] = { 1, rfbSecTypeItalc } ;
-	sd.write( (const char *) secTypeList, sizeof( secTypeList ) );
 
-	uint8_t chosen = 0;
-	sd.read( (char *) &chosen, sizeof( chosen ) );
 
-	if( chosen != rfbSecTypeItalc )
+bool DemoServerClient::hasBacklog() const
+{
+	if( m_outgoingQueue.isEmpty() == false || m_sock->bytesToWrite() > 0 )
 	{
-		qCritical( "DemoServerClient:::run(): "
-					"protocol initialization failed" );
-		deleteLater();
-		return;
+		return true;
 	}
 
-	uint32_t authResult = Swap32IfLE(rfbVncAuthFailed);
-
-    if( ItalcCoreServer::instance()->
-			authSecTypeItalc( qtcpsocketDispatcher, m_sock ) != true )
+#ifdef ITALC_BUILD_LINUX
+	// the socket buffer of the OS easily holds a whole frame so data
+	// passed to it still might be far from having arrived at the client
+	int unacknowledged = 0;
+	if( ioctl( m_sock->socketDescriptor(), TIOCOUTQ, &unacknowledged ) == 0 &&
+			unacknowledged > 0 )
 	{
-		qWarning("auth of demo client failed\n");
-		deleteLater();
-		return;
+		return true;
 	}
+#endif
 
-	authResult = Swap32IfLE(rfbVncAuthOK);
+	return false;
+}
 
-	sd.write( (char *) &authResult, sizeof( authResult ) );
 
-	rfbClientInitMsg ci;
 
-	if( !sd.read( (char *) &ci, sz_rfbClientInitMsg ) )
-	{
-		qWarning( "failed reading rfbClientInitMsg" );
-		deleteLater();
-		return;
-	}
 
-	rfbServerInitMsg si = m_vncConn->getRfbClient()->si;
-	si.framebufferWidth = Swap16IfLE( si.framebufferWidth );
-	si.framebufferHeight = Swap16IfLE( si.framebufferHeight );
-	si.format.redMax = Swap16IfLE( si.format.redMax );
-	si.format.greenMax = Swap16IfLE( si.format.greenMax );
-	si.format.blueMax = Swap16IfLE( si.format.blueMax );
-	si.format.bigEndian = ( QSysInfo::ByteOrder == QSysInfo::BigEndian )
-									? 1 : 0;
-	si.nameLength = 0;
-	if( !sd.write( ( const char *) &si, sz_rfbServerInitMsg ) )
+int DemoServerClient::frameDelay() const
+{
+	if( m_lastFrameTimer.isValid() == false )
 	{
-		qWarning( "failed writing rfbServerInitMsg" );
-		deleteLater();
-		return;
+		return 0;
 	}
 
+	// timer has been started before encoding the last frame so it covers
+	// the time needed for encoding and sending it
+	return qBound<qint64>( 0, FrameInterval - m_lastFrameTimer.elapsed(),
+							FrameInterval );
+}
 
-	connect( m_vncConn, SIGNAL( cursorShapeUpdated( const QImage &, int, int ) ),
-			this, SLOT( updateCursorShape( const QImage &, int, int ) ),
-							Qt::QueuedConnection );
-	connect( m_vncConn, SIGNAL( imageUpdated( int, int, int, int ) ),
-			this, SLOT( updateRect( int, int, int, int ) ),
-							Qt::QueuedConnection );
 
-	ml.unlock();
 
-	// TODO
-	//updateCursorShape( m_demoServer->initialCursorShape(), 0, 0 );
 
-	// first time send a key-frame
-	QSize s = m_vncConn->framebufferSize();
-	updateRect( 0, 0, s.width(), s.height() );
+void DemoServerClient::enqueue( const QByteArray &data )
+{
+	m_outgoingQueue += data;
+	flushOutgoingQueue();
+}
+
 
-	connect( m_sock, SIGNAL( readyRead() ),
-				this, SLOT( processClient() ), Qt::DirectConnection );
-	connect( m_sock, SIGNAL( disconnected() ),
-						this, SLOT( quit() ) );
 
-	// TODO
-/*	QTimer t;
-	connect( &t, SIGNAL( timeout() ),
-			this, SLOT( moveCursor() ), Qt::DirectConnection );
-	t.start( CURSOR_UPDATE_TIME );*/
 
-/*	QTimer t2;
-	connect( &t2, SIGNAL( timeout() ),
-			this, SLOT( processClient() ), Qt::DirectConnection );
-	t2.start( 2*CURSOR_UPDATE_TIME );*/
+qint64 DemoServerClient::nextMessageSize() const
+{
+	const qint64 available = m_sock->bytesAvailable();
+	if( available < 1 )
+	{
+		return 0;
+	}
 
-	// now run our own event-loop for optimal scheduling
-	exec();
+	rfbClientToServerMsg msg;
+	qint64 size = 1;
 
-	deleteLater();
+	m_sock->peek( (char *) &msg, 1 );
+	switch( msg.type )
+	{
+		case rfbSetEncodings:
+			if( available < sz_rfbSetEncodingsMsg )
+			{
+				return 0;
+			}
+			m_sock->peek( (char *) &msg, sz_rfbSetEncodingsMsg );
+			size = sz_rfbSetEncodingsMsg +
+					Swap16IfLE( msg.se.nEncodings ) * sizeof( uint32_t );
+			break;
+		case rfbClientCutText:
+			if( available < sz_rfbClientCutTextMsg )
+			{
+				return 0;
+			}
+			m_sock->peek( (char *) &msg, sz_rfbClientCutTextMsg );
+			size = sz_rfbClientCutTextMsg + Swap32IfLE( msg.cct.length );
+			break;
+		case rfbSetPixelFormat:
+			size = sz_rfbSetPixelFormatMsg;
+			break;
+		case rfbSetServerInput:
+			size = sz_rfbSetServerInputMsg;
+			break;
+		case rfbFramebufferUpdateRequest:
+			size = sz_rfbFramebufferUpdateRequestMsg;
+			break;
+		default:
+			// unknown message - just skip its type
+			break;
+	}
+
+	return available >= size ? size : 0;
 }
 
 
+
+
+void DemoServerClient::processClient()
+{
+	qint64 size;
+	while( ( size = nextMessageSize() ) > 0 )
+	{
+		const QByteArray data = m_sock->read( size );
+		const uint8_t type = data[0];
+
+		switch( type )
+		{
+			case rfbSetEncodings:
+			{
+				const uint32_t *encodings = (const uint32_t *)
+						( data.constData() + sz_rfbSetEncodingsMsg );
+				const int n = ( data.size() - sz_rfbSetEncodingsMsg ) /
+															sizeof( uint32_t );
+				m_deltaEncoding = false;
+				m_tileGenerations.clear();
+				for( int i = 0; i < n; ++i )
+				{
+					if( Swap32IfLE( encodings[i] ) == rfbEncodingLZORLEDelta )
+					{
+						m_deltaEncoding = true;
+					}
+				}
+				break;
+			}
+			case rfbSetPixelFormat:
+			case rfbSetServerInput:
+			case rfbClientCutText:
+				break;
+			case rfbFramebufferUpdateRequest:
+				m_updatesPending = true;
+				break;
+			default:
+				qWarning( "DemoServerClient::processClient(): "
+							"ignoring msg type %d", type );
+				break;
+		}
+	}
+
+	if( m_updatesPending )
+	{
+		sendUpdates();
+	}
+}
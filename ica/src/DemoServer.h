@@ -26,11 +26,20 @@
 #ifndef DEMO_SERVER_H
 #define DEMO_SERVER_H
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QPair>
 #include <QtCore/QReadWriteLock>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
 #include <QtNetwork/QTcpServer>
 
+#include "DemoServerEncoder.h"
 #include "ItalcVncConnection.h"
+#include "SharedFramebuffer.h"
+
+class QTcpSocket;
 
 
 // there's one instance of a DemoServer on the iTALC master
@@ -38,9 +47,34 @@ class DemoServer : public QTcpServer
 {
 	Q_OBJECT
 public:
-	DemoServer( int srcPort, int dstPort, QObject *parent );
+	enum {
+		MaxEventLoops = 4,
+		MaxHandshakeThreads = 8
+	} ;
+
+	// pixels are taken from shared framebuffer if it can be opened,
+	// otherwise from a VNC connection to srcPort
+	DemoServer( int srcPort, int dstPort, const QString &sharedFramebuffer,
+															QObject *parent );
 	virtual ~DemoServer();
 
+	bool usesSharedFramebuffer() const
+	{
+		return m_sharedFramebuffer.isOpen();
+	}
+
+	const QImage framebuffer() const
+	{
+		return usesSharedFramebuffer() ? m_sharedFramebuffer.image() :
+											m_vncConn.image();
+	}
+
+	QSize framebufferSize() const
+	{
+		return usesSharedFramebuffer() ? m_sharedFramebuffer.framebufferSize() :
+											m_vncConn.framebufferSize();
+	}
+
 	QPoint cursorPos()
 	{
 		m_cursorLock.lockForRead();
@@ -57,6 +91,20 @@ public:
 		return i;
 	}
 
+	DemoServerEncoder & encoder()
+	{
+		return m_encoder;
+	}
+
+	// returns one of the event loop threads all authenticated clients are
+	// distributed to
+	QThread *nextEventLoop();
+
+
+signals:
+	// emitted after cached encoded tiles have been invalidated
+	void framebufferUpdated( int x, int y, int w, int h );
+
 
 private slots:
 	// checks whether cursor was moved and sets according flags and
@@ -66,84 +114,143 @@ private slots:
 	void checkForCursorMovement();
 	void updateInitialCursorShape( const QImage &img, int x, int y );
 
+	// invalidate cached encoded tiles - connected directly to signals of
+	// m_vncConn or m_sharedFramebuffer, i.e. called in their thread before
+	// any DemoServerClient gets to know about the change
+	void invalidateEncodedRect( int x, int y, int w, int h );
+	void invalidateEncodedFramebuffer();
+
 
 private:
-	virtual void incomingConnection( int sock );
+	virtual void incomingConnection( qintptr sock );
 
 	ItalcVncConnection m_vncConn;
+	SharedFramebufferReader m_sharedFramebuffer;
+	DemoServerEncoder m_encoder;
 	QReadWriteLock m_cursorLock;
 	QImage m_initialCursorShape;
 	QPoint m_cursorPos;
 
+	// protocol initialization and authentication are blocking and thus
+	// are done on a small pool of threads before handing over the
+	// connection to one of the event loops
+	QThreadPool m_handshakePool;
+	QVector<QThread *> m_eventLoops;
+	QAtomicInt m_nextEventLoop;
+
 } ;
 
 
 
-// the demo-server creates an instance of this class for each client, i.e.
-// each client is connected to a different server-thread for a maximum
-// performance
-class DemoServerClient : public QThread
+// the demo-server creates an instance of this class for each client - all
+// instances are served non-blocking by a few event loop threads so the
+// number of threads does not grow with the number of clients
+class DemoServerClient : public QObject
 {
 	Q_OBJECT
 public:
-	DemoServerClient( int sock, const ItalcVncConnection *vncConn,
+	enum {
+		// stop feeding the socket's write buffer once it holds more than
+		// this, remaining data stays in our outgoing queue
+		MaxSocketBufferSize = 256*1024,
+		// collapse changed region into its bounding rect if it gets more
+		// fragmented than this while the client can't keep up
+		MaxChangedRects = 256,
+		// minimum time (in ms) between start of two frames
+		FrameInterval = 40,
+		// interval (in ms) in which we check whether data passed to the OS
+		// has been received by the client
+		BacklogPollInterval = 10
+	} ;
+
+	// sock has to be connected and authenticated already
+	DemoServerClient( QTcpSocket *sock, const ItalcVncConnection *vncConn,
 							DemoServer *parent );
 	virtual ~DemoServerClient();
 
 
+public slots:
+	// has to be invoked in context of event loop thread after the client
+	// has been moved there
+	void start();
+
+
 private slots:
-	// connected to imageUpdated(...)-signal of demo-server's
-	// VNC connection - this way we can record changes in screen, later we
-	// extract single, non-overlapping rectangles out of changed region for
-	// updating as less as possible of screen
+	// connected to framebufferUpdated(...)-signal of demo-server - this
+	// way we can record changes in screen, later we extract single,
+	// non-overlapping rectangles out of changed region for updating as
+	// less as possible of screen
 	void updateRect( int x, int y, int w, int h );
 
 	// called whenever ItalcVncConnection::cursorShapeUpdated() is emitted
 	void updateCursorShape( const QImage &cursorShape, int xh, int yh );
 
 	// called regularly for sending pointer-movement-events detected by
-	// checkForCursorMovement() to clients - connection has to be done
-	// in DemoServerClient-thread-context as we're writing to socket
+	// checkForCursorMovement() to clients
 	void moveCursor();
 
 	// connected to readyRead()-signal of our client-socket and called as
-	// soon as the clients sends something (e.g. an update-request)
+	// soon as the clients sends something (e.g. an update-request) - only
+	// complete messages are processed, partial ones are left in the socket
 	void processClient();
 
 	// actually sends framebuffer update - if there's nothing to send but
 	// an update response pending, it will start a singleshot timer
 	void sendUpdates();
 
+	// moves data from outgoing queue to socket as far as socket's write
+	// buffer allows
+	void flushOutgoingQueue();
+
+
 private:
-	// thread-entry-point - does some initializations and then enters
-	// event-loop of thread
-	virtual void run();
+	// returns size of next complete message in socket or 0 if more data
+	// is required
+	qint64 nextMessageSize() const;
+
+	void enqueue( const QByteArray &data );
+
+	// returns whether previous frame still is being transferred - this
+	// includes data already passed to the OS but not acknowledged by the
+	// client yet where the OS tells us about it
+	bool hasBacklog() const;
+
+	// (re)starts m_sendTimer unless it would fire earlier anyway
+	void scheduleUpdate( int msecs );
+
+	// returns number of milliseconds to wait before next frame so frames
+	// which were encoded and sent faster than FrameInterval are not
+	// followed by the next one immediately
+	int frameDelay() const;
 
 	DemoServer * m_demoServer;
-	QMutex m_dataMutex;
 	bool m_updatesPending;
-	QList<QRect> m_changedRects;
+	QRegion m_changedRegion;
 	QImage m_cursorShape;
 	int m_cursorHotX;
 	int m_cursorHotY;
 	QPoint m_lastCursorPos;
-	volatile bool m_cursorShapeChanged;
+	bool m_cursorShapeChanged;
 
-	int m_socketDescriptor;
 	QTcpSocket *m_sock;
 	const ItalcVncConnection *m_vncConn;
 	bool m_otherEndianess;
-	char *m_lzoWorkMem;
-	QRgb *m_rawBuf;
 
-	uint8_t *m_rleBuf;
-	size_t m_currentRleBufSize;
+	// whether client supports rfbEncodingLZORLEDelta and which tiles it
+	// has received so far
+	bool m_deltaEncoding;
+	DemoServerEncoder::TileGenerations m_tileGenerations;
+
+	QList<QByteArray> m_outgoingQueue;
+	QTimer m_sendTimer;
+	QTimer m_backlogTimer;
 
-	uint8_t *m_lzoOutBuf;
-	size_t m_currentLzoOutBufSize;
+	// flow control - time since last frame has been started to be encoded
+	// and whether it has been received by the client completely
+	QElapsedTimer m_lastFrameTimer;
+	bool m_lastFrameDrained;
 
 } ;
 
 
 #endif
-
@@ -0,0 +1,534 @@
+/*
+ * DemoServerEncoder.cpp - parallel tile-based LZORLE encoder for DemoServer
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
+#include <QtCore/QThread>
+
+#include "DemoServerEncoder.h"
+#include "RfbLZORLE.h"
+
+
+struct DemoServerEncoder::TileTask
+{
+	enum States
+	{
+		Skipped,	// client already has this tile
+		Cached,
+		Pending,	// being encoded by another thread
+		Own,
+		Uncached	// invalidated while being encoded by another thread
+	} ;
+
+	QRect rect;
+	quint32 key;
+	quint32 generation;
+	quint32 baseGeneration;
+	States state;
+	QImage pixels;		// snapshot of tile for delta encoding
+	QImage reference;	// pixels the client has if baseGeneration != 0
+} ;
+
+
+
+class TileEncoderJob : public QRunnable
+{
+public:
+	TileEncoderJob( const QImage &image,
+					const DemoServerEncoder::TileTask &task,
+					bool otherEndianess, QByteArray *out,
+					QSemaphore *done ) :
+		QRunnable(),
+		m_image( image ),
+		m_task( task ),
+		m_otherEndianess( otherEndianess ),
+		m_out( out ),
+		m_done( done )
+	{
+		setAutoDelete( true );
+	}
+
+	virtual void run()
+	{
+		DemoServerEncoder::encodeTask( m_image, m_task, m_otherEndianess,
+										*m_out );
+		m_done->release();
+	}
+
+
+private:
+	const QImage m_image;
+	const DemoServerEncoder::TileTask &m_task;
+	const bool m_otherEndianess;
+	QByteArray *m_out;
+	QSemaphore *m_done;
+
+} ;
+
+
+
+
+DemoServerEncoder::DemoServerEncoder() :
+	m_threadPool(),
+	m_generation( 1 ),
+	m_resetGeneration( 1 ),
+	m_tileGenerations(),
+	m_cache(),
+	m_snapshots(),
+	m_cacheMutex(),
+	m_tileEncoded()
+{
+	m_threadPool.setMaxThreadCount( qMax( 1, QThread::idealThreadCount() ) );
+}
+
+
+
+
+DemoServerEncoder::~DemoServerEncoder()
+{
+	m_threadPool.waitForDone();
+}
+
+
+
+
+QList<QByteArray> DemoServerEncoder::encode( const QImage &image,
+												const QRegion &region,
+												bool otherEndianess,
+												TileGenerations *clientTiles )
+{
+	const bool delta = clientTiles != NULL;
+	const QVector<QRect> t = delta ? fullTiles( region, image.rect() ) :
+										tiles( region & image.rect() );
+
+	QVector<TileTask> tasks( t.size() );
+	QList<QByteArray> encodedTiles;
+	encodedTiles.reserve( t.size() );
+	for( int i = 0; i < t.size(); ++i )
+	{
+		encodedTiles += QByteArray();
+	}
+
+	// tiles we're going to encode and tiles currently being encoded by
+	// another thread
+	QVector<int> ownTiles;
+	QVector<int> pendingTiles;
+
+	m_cacheMutex.lock();
+	for( int i = 0; i < t.size(); ++i )
+	{
+		TileTask &task = tasks[i];
+		task.rect = t[i];
+		task.key = tileKey( t[i] );
+		task.generation = m_tileGenerations.value( task.key, m_resetGeneration );
+		task.baseGeneration = 0;
+
+		if( delta )
+		{
+			const quint32 known = clientTiles->value( task.key );
+			if( known == task.generation )
+			{
+				task.state = TileTask::Skipped;
+				continue;
+			}
+			task.reference = snapshot( task.key, known );
+			if( task.reference.isNull() == false )
+			{
+				task.baseGeneration = known;
+			}
+		}
+
+		const int e = findCacheEntry( task, otherEndianess, delta );
+		if( e >= 0 )
+		{
+			const CacheEntry &entry = m_cache[task.key][e];
+			if( entry.encoding )
+			{
+				task.state = TileTask::Pending;
+				pendingTiles += i;
+			}
+			else
+			{
+				task.state = TileTask::Cached;
+				encodedTiles[i] = entry.data;
+			}
+		}
+		else
+		{
+			// announce that we're encoding this tile so other threads
+			// wait for us instead of encoding it as well
+			const CacheEntry entry = { task.generation, task.baseGeneration,
+										delta, task.rect, otherEndianess,
+										true, QByteArray() } ;
+			m_cache[task.key] += entry;
+			task.state = TileTask::Own;
+			if( delta )
+			{
+				task.pixels = snapshot( task.key, task.generation );
+			}
+			ownTiles += i;
+		}
+	}
+	m_cacheMutex.unlock();
+
+	if( delta )
+	{
+		// all delta encodings of a tile generation have to be based on the
+		// same pixels, so take a snapshot unless someone else already did
+		QVector<int> newSnapshots;
+		for( int i : ownTiles )
+		{
+			if( tasks[i].pixels.isNull() )
+			{
+				tasks[i].pixels = image.copy( tasks[i].rect );
+				newSnapshots += i;
+			}
+		}
+
+		m_cacheMutex.lock();
+		for( int i : newSnapshots )
+		{
+			tasks[i].pixels = addSnapshot( tasks[i].key, tasks[i].generation,
+											tasks[i].pixels );
+		}
+		m_cacheMutex.unlock();
+	}
+
+	if( ownTiles.size() == 1 )
+	{
+		// no need to bother worker threads with a single tile
+		const int i = ownTiles.first();
+		encodeTask( image, tasks[i], otherEndianess, encodedTiles[i] );
+	}
+	else if( ownTiles.size() > 1 )
+	{
+		// the worker threads write into separate QByteArrays whose
+		// addresses stay valid as we do not modify the list until all
+		// jobs are done
+		QSemaphore done;
+		for( int i : ownTiles )
+		{
+			m_threadPool.start( new TileEncoderJob( image, tasks[i],
+													otherEndianess,
+													&encodedTiles[i],
+													&done ) );
+		}
+
+		done.acquire( ownTiles.size() );
+	}
+
+	m_cacheMutex.lock();
+
+	// publish our tiles unless they have been invalidated meanwhile
+	for( int i : ownTiles )
+	{
+		const int e = findCacheEntry( tasks[i], otherEndianess, delta );
+		if( e >= 0 )
+		{
+			CacheEntry &entry = m_cache[tasks[i].key][e];
+			if( entry.encoding && entry.fromSnapshot == delta )
+			{
+				entry.data = encodedTiles[i];
+				entry.encoding = false;
+			}
+		}
+	}
+	if( ownTiles.isEmpty() == false )
+	{
+		m_tileEncoded.wakeAll();
+	}
+
+	// collect tiles encoded by other threads - as we've published all of
+	// our tiles before, two threads can't end up waiting for each other
+	QVector<int> uncachedTiles;
+	for( int i : pendingTiles )
+	{
+		forever
+		{
+			const int e = findCacheEntry( tasks[i], otherEndianess, delta );
+			if( e < 0 )
+			{
+				// tile has been invalidated or replaced meanwhile
+				tasks[i].state = TileTask::Uncached;
+				uncachedTiles += i;
+				break;
+			}
+			const CacheEntry &entry = m_cache[tasks[i].key][e];
+			if( entry.encoding == false )
+			{
+				encodedTiles[i] = entry.data;
+				break;
+			}
+			m_tileEncoded.wait( &m_cacheMutex );
+		}
+	}
+
+	m_cacheMutex.unlock();
+
+	for( int i : uncachedTiles )
+	{
+		RfbLZORLE::encodeRect( image, t[i], otherEndianess, encodedTiles[i] );
+	}
+
+	// remove skipped tiles and remember what the client is going to have
+	for( int i = tasks.size()-1; i >= 0; --i )
+	{
+		switch( tasks[i].state )
+		{
+			case TileTask::Skipped:
+				encodedTiles.removeAt( i );
+				break;
+			case TileTask::Uncached:
+				// not based on a snapshot and thus unusable as reference
+				if( delta )
+				{
+					clientTiles->remove( tasks[i].key );
+				}
+				break;
+			default:
+				if( delta )
+				{
+					clientTiles->insert( tasks[i].key, tasks[i].generation );
+				}
+				break;
+		}
+	}
+
+	return encodedTiles;
+}
+
+
+
+
+void DemoServerEncoder::invalidate( const QRect &rect )
+{
+	if( rect.isEmpty() )
+	{
+		return;
+	}
+
+	QMutexLocker ml( &m_cacheMutex );
+
+	++m_generation;
+
+	for( int ty = rect.top() / TileSize; ty <= rect.bottom() / TileSize; ++ty )
+	{
+		for( int tx = rect.left() / TileSize; tx <= rect.right() / TileSize; ++tx )
+		{
+			const quint32 key = ( ty << 16 ) | tx;
+			m_tileGenerations[key] = m_generation;
+			// snapshots are kept as they still are needed as reference
+			// for clients which have not been updated yet
+			m_cache.remove( key );
+		}
+	}
+}
+
+
+
+
+void DemoServerEncoder::invalidateAll()
+{
+	QMutexLocker ml( &m_cacheMutex );
+
+	m_resetGeneration = ++m_generation;
+	m_tileGenerations.clear();
+	m_cache.clear();
+	m_snapshots.clear();
+}
+
+
+
+
+void DemoServerEncoder::encodeTask( const QImage &image, const TileTask &task,
+									bool otherEndianess, QByteArray &out )
+{
+	if( task.pixels.isNull() )
+	{
+		RfbLZORLE::encodeRect( image, task.rect, otherEndianess, out );
+	}
+	else if( task.baseGeneration == 0 )
+	{
+		RfbLZORLE::encodeTile( task.pixels, task.rect.topLeft(),
+								otherEndianess, out );
+	}
+	else
+	{
+		RfbLZORLE::encodeDeltaTile( task.pixels, task.reference,
+									task.rect.topLeft(), otherEndianess, out );
+	}
+}
+
+
+
+
+int DemoServerEncoder::findCacheEntry( const TileTask &task,
+										bool otherEndianess,
+										bool requireSnapshot ) const
+{
+	QHash<quint32, CacheEntryList>::ConstIterator it = m_cache.find( task.key );
+	if( it == m_cache.end() )
+	{
+		return -1;
+	}
+
+	// encodings not based on a snapshot can't be used for delta clients
+	// as we would not know which pixels they have afterwards
+	for( int e = 0; e < it->size(); ++e )
+	{
+		const CacheEntry &entry = it->at( e );
+		if( entry.generation == task.generation &&
+				entry.baseGeneration == task.baseGeneration &&
+				entry.rect == task.rect &&
+				entry.otherEndianess == otherEndianess &&
+				( entry.fromSnapshot || requireSnapshot == false ) )
+		{
+			return e;
+		}
+	}
+
+	return -1;
+}
+
+
+
+
+QImage DemoServerEncoder::snapshot( quint32 key, quint32 generation ) const
+{
+	for( const TileSnapshot &s : m_snapshots.value( key ) )
+	{
+		if( s.generation == generation )
+		{
+			return s.pixels;
+		}
+	}
+
+	return QImage();
+}
+
+
+
+
+QImage DemoServerEncoder::addSnapshot( quint32 key, quint32 generation,
+										const QImage &pixels )
+{
+	TileSnapshotList &snapshots = m_snapshots[key];
+
+	for( const TileSnapshot &s : snapshots )
+	{
+		if( s.generation == generation )
+		{
+			// someone else has been faster
+			return s.pixels;
+		}
+	}
+
+	const TileSnapshot s = { generation, pixels } ;
+	snapshots += s;
+
+	// drop oldest snapshot - clients still referring to it will get a
+	// complete tile next time
+	if( snapshots.size() > MaxSnapshotsPerTile )
+	{
+		int oldest = 0;
+		for( int i = 1; i < snapshots.size(); ++i )
+		{
+			if( snapshots[i].generation < snapshots[oldest].generation )
+			{
+				oldest = i;
+			}
+		}
+		snapshots.removeAt( oldest );
+	}
+
+	return pixels;
+}
+
+
+
+
+QVector<QRect> DemoServerEncoder::tiles( const QRegion &region )
+{
+	QVector<QRect> rects = region.rects();
+
+	// make sure we can announce all rectangles in a single
+	// rfbFramebufferUpdateMsg even for heavily fragmented regions
+	int numTiles = 0;
+	for( const QRect &r : rects )
+	{
+		numTiles += ( r.right() / TileSize - r.left() / TileSize + 1 ) *
+					( r.bottom() / TileSize - r.top() / TileSize + 1 );
+	}
+	if( numTiles > MaxRectsPerUpdate )
+	{
+		rects = QVector<QRect>() << region.boundingRect();
+	}
+
+	// split rects along a fixed grid so neighboured tiles of subsequent
+	// updates always cover the same screen areas
+	QVector<QRect> t;
+	for( const QRect &r : rects )
+	{
+		for( int ty = r.top() / TileSize; ty <= r.bottom() / TileSize; ++ty )
+		{
+			for( int tx = r.left() / TileSize; tx <= r.right() / TileSize; ++tx )
+			{
+				t += r & QRect( tx * TileSize, ty * TileSize,
+								TileSize, TileSize );
+			}
+		}
+	}
+
+	return t;
+}
+
+
+
+
+QVector<QRect> DemoServerEncoder::fullTiles( const QRegion &region,
+												const QRect &bounds )
+{
+	QVector<QRect> t;
+
+	const QRect r = region.boundingRect() & bounds;
+	if( r.isEmpty() )
+	{
+		return t;
+	}
+
+	for( int ty = r.top() / TileSize; ty <= r.bottom() / TileSize; ++ty )
+	{
+		for( int tx = r.left() / TileSize; tx <= r.right() / TileSize; ++tx )
+		{
+			const QRect tile = QRect( tx * TileSize, ty * TileSize,
+										TileSize, TileSize ) & bounds;
+			if( region.intersects( tile ) )
+			{
+				t += tile;
+			}
+		}
+	}
+
+	return t;
+}
@@ -0,0 +1,132 @@
+/*
+ * DemoServerEncoder.h - parallel tile-based LZORLE encoder for DemoServer
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef DEMO_SERVER_ENCODER_H
+#define DEMO_SERVER_ENCODER_H
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QThreadPool>
+#include <QtCore/QWaitCondition>
+#include <QtGui/QImage>
+#include <QtGui/QRegion>
+
+
+// splits changed regions into fixed tiles and encodes them in parallel on a
+// worker pool shared by all DemoServerClient threads - encoded tiles are
+// cached so each tile is only encoded once per framebuffer change no matter
+// how many clients request it
+class DemoServerEncoder
+{
+public:
+	enum {
+		TileSize = 64,
+		MaxRectsPerUpdate = 0xff00,	// leave room for pseudo encodings
+		MaxSnapshotsPerTile = 2
+	} ;
+
+	// generation of each tile a client has received so far - only
+	// required for clients supporting delta encoding
+	typedef QHash<quint32, quint32> TileGenerations;
+
+	DemoServerEncoder();
+	~DemoServerEncoder();
+
+	// returns list of encoded rectangles (each including its RFB rectangle
+	// header) covering given region - order of list matches the order of
+	// tiles from top-left to bottom-right - if clientTiles is given, whole
+	// tiles are encoded as difference to the ones the client already has
+	// and clientTiles is updated accordingly
+	QList<QByteArray> encode( const QImage &image, const QRegion &region,
+								bool otherEndianess,
+								TileGenerations *clientTiles = NULL );
+
+	// marks all cached tiles touching given rectangle as outdated - has to
+	// be called before the rectangle is announced to any DemoServerClient
+	void invalidate( const QRect &rect );
+
+	// drops all cached tiles, e.g. after framebuffer size changed
+	void invalidateAll();
+
+	static QVector<QRect> tiles( const QRegion &region );
+
+	// returns all complete tiles (clipped to bounds) touched by region
+	static QVector<QRect> fullTiles( const QRegion &region, const QRect &bounds );
+
+
+private:
+	struct CacheEntry
+	{
+		quint32 generation;
+		quint32 baseGeneration;		// 0 if not delta encoded
+		bool fromSnapshot;
+		QRect rect;
+		bool otherEndianess;
+		bool encoding;
+		QByteArray data;
+	} ;
+	typedef QList<CacheEntry> CacheEntryList;
+
+	// pixels of a tile as sent to clients supporting delta encoding
+	struct TileSnapshot
+	{
+		quint32 generation;
+		QImage pixels;
+	} ;
+	typedef QList<TileSnapshot> TileSnapshotList;
+
+	struct TileTask;
+	friend class TileEncoderJob;
+
+	static quint32 tileKey( const QRect &rect )
+	{
+		return ( ( rect.top() / TileSize ) << 16 ) | ( rect.left() / TileSize );
+	}
+
+	static void encodeTask( const QImage &image, const TileTask &task,
+							bool otherEndianess, QByteArray &out );
+
+	// the following functions require m_cacheMutex to be locked
+	int findCacheEntry( const TileTask &task, bool otherEndianess,
+						bool requireSnapshot ) const;
+	QImage snapshot( quint32 key, quint32 generation ) const;
+	QImage addSnapshot( quint32 key, quint32 generation,
+						const QImage &pixels );
+
+	QThreadPool m_threadPool;
+
+	// generation of framebuffer contents - increased with every change and
+	// stored per tile so we know whether a cached tile is still valid
+	quint32 m_generation;
+	quint32 m_resetGeneration;
+	QHash<quint32, quint32> m_tileGenerations;
+	QHash<quint32, CacheEntryList> m_cache;
+	QHash<quint32, TileSnapshotList> m_snapshots;
+	QMutex m_cacheMutex;
+	QWaitCondition m_tileEncoded;
+
+} ;
+
+#endif
@@ -26,6 +26,7 @@
 #include "DemoServerMaster.h"
 #include "ItalcCore.h"
 #include "ItalcSlaveManager.h"
+#include "SharedFramebuffer.h"
 
 
 DemoServerMaster::DemoServerMaster( ItalcSlaveManager *slaveManager ) :
@@ -51,7 +52,9 @@ void DemoServerMaster::start( int sourcePort, int destinationPort )
 						addArg( ItalcSlaveManager::DemoServer::CommonSecret,
 									ItalcCore::authenticationCredentials->commonSecret() ).
 						addArg( ItalcSlaveManager::DemoServer::SourcePort, sourcePort ).
-						addArg( ItalcSlaveManager::DemoServer::DestinationPort, destinationPort ) );
+						addArg( ItalcSlaveManager::DemoServer::DestinationPort, destinationPort ).
+						addArg( ItalcSlaveManager::DemoServer::SharedFramebuffer,
+									SharedFramebuffer::segmentName() ) );
 
 	m_serverPort = destinationPort;
 }
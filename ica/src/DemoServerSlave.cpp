@@ -95,7 +95,9 @@ bool DemoServerSlave::handleMessage( const Ipc::Msg &m )
 		}
 		else
 		{
-			m_demoServer = new DemoServer( srcPort, dstPort, this );
+			m_demoServer = new DemoServer( srcPort, dstPort,
+					m.arg( ItalcSlaveManager::DemoServer::SharedFramebuffer ),
+					this );
 		}
 		return true;
 	}
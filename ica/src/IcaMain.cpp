@@ -24,7 +24,9 @@
 
 #include <italcconfig.h>
 
+#include <QtCore/QMutex>
 #include <QtCore/QProcess>
+#include <QtCore/QThread>
 #include <QApplication>
 #include <QAbstractNativeEventFilter>
 #include <QtNetwork/QHostInfo>
@@ -44,6 +46,8 @@
 #include "ScreenLockSlave.h"
 #include "SystemTrayIconSlave.h"
 
+#include <openssl/crypto.h>
+
 
 #ifdef ITALC_BUILD_WIN32
 static HANDLE hShutdownEvent = NULL;
@@ -76,6 +80,49 @@ public:
 
 
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+// OpenSSL < 1.1 is only thread-safe if the application provides locking
+// callbacks - without them concurrent signature verifications in
+// ItalcCoreServer::doKeyBasedAuth() corrupt the shared public key
+static QMutex *openSslMutexes = NULL;
+
+static void openSslLockingCallback( int mode, int n, const char *, int )
+{
+	if( mode & CRYPTO_LOCK )
+	{
+		openSslMutexes[n].lock();
+	}
+	else
+	{
+		openSslMutexes[n].unlock();
+	}
+}
+
+
+
+static unsigned long openSslIdCallback()
+{
+	return (unsigned long) QThread::currentThreadId();
+}
+#endif
+
+
+
+static void initOpenSslThreading()
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	if( openSslMutexes == NULL )
+	{
+		openSslMutexes = new QMutex[CRYPTO_num_locks()];
+		CRYPTO_set_id_callback( openSslIdCallback );
+		CRYPTO_set_locking_callback( openSslLockingCallback );
+	}
+#endif
+}
+
+
+
+
 static bool parseArguments( const QStringList &arguments )
 {
 	QStringListIterator argIt( arguments );
@@ -192,6 +239,10 @@ static int runCoreServer( int argc, char **argv )
 	app.installNativeEventFilter( &eventFilter );
 #endif
 
+	// must happen before ItalcCoreServer starts verifying signatures in
+	// worker threads
+	initOpenSslThreading();
+
 	ItalcCoreServer coreServer;
 	ItalcVncServer vncServer;
 
@@ -32,14 +32,21 @@
 #endif
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QMessageAuthenticationCode>
+#include <QtCore/QThread>
 #include <QtNetwork/QHostInfo>
 
 #include "ItalcCoreServer.h"
 #include "DesktopAccessPermission.h"
 #include "DsaKey.h"
+#include "FramebufferTileHashes.h"
 #include "ItalcRfbExt.h"
 #include "LocalSystem.h"
 
+#include <openssl/rand.h>
+
 
 ItalcCoreServer * ItalcCoreServer::_this = NULL;
 
@@ -48,10 +55,25 @@ ItalcCoreServer::ItalcCoreServer() :
 	QObject(),
 	m_allowedIPs(),
 	m_failedAuthHosts(),
+	m_publicKeys(),
+	m_sessionTicketKey( DsaKey::generateChallenge() ),
+	m_usedSessionTickets(),
+	m_accessPermissionMutex(),
+	m_signatureVerifications( qMax( 1, QThread::idealThreadCount() ) ),
+	m_notificationMutex(),
+	m_userName(),
+	m_userHomeDir(),
+	m_slaveStateFlags( 0 ),
+	m_notificationSubscribers(),
+	m_notificationTimer( this ),
 	m_slaveManager()
 {
 	Q_ASSERT( _this == NULL );
 	_this = this;
+
+	connect( &m_notificationTimer, SIGNAL( timeout() ),
+				this, SLOT( updateNotificationState() ) );
+	m_notificationTimer.start( NotificationStateInterval );
 }
 
 
@@ -65,6 +87,55 @@ ItalcCoreServer::~ItalcCoreServer()
 
 
 
+// user name (including full name if available) and home directory of
+// logged on user - called by main thread and threads of VNC server
+static void loggedOnUserInformation( QString *userName, QString *homeDir )
+{
+	static QMutex mutex;
+	static QString lastUserName, lastFullUsername;
+
+	LocalSystem::User user = LocalSystem::User::loggedOnUser();
+	QString currentUsername = user.name();
+
+	QMutexLocker l( &mutex );
+	if( lastUserName != currentUsername )
+	{
+		lastUserName = currentUsername;
+		lastFullUsername = user.fullName();
+	}
+	if( !lastFullUsername.isEmpty() &&
+			currentUsername != lastFullUsername )
+	{
+		currentUsername = QString( "%1 (%2)" ).arg( currentUsername ).
+								arg( lastFullUsername );
+	}
+
+	*userName = currentUsername;
+	*homeDir = user.homePath();
+}
+
+
+
+// answer to given request in a format supported by its sender - carries ID
+// of request so the sender is able to correlate both
+static ItalcCore::Msg reply( SocketDevice *sdev, const ItalcCore::Msg &request,
+								const ItalcCore::Command &cmd )
+{
+	ItalcCore::Msg m( sdev, cmd );
+	m.setFramed( request.senderSupportsFraming() );
+
+	const QString requestId = request.arg( "requestid" );
+	if( !requestId.isEmpty() )
+	{
+		m.addArg( "requestid", requestId );
+	}
+
+	return m;
+}
+
+
+
+
 int ItalcCoreServer::handleItalcClientMessage( socketDispatcher sock,
 												void *user )
 {
@@ -78,178 +149,323 @@ int ItalcCoreServer::handleItalcClientMessage( socketDispatcher sock,
 					<< "with arguments" << msgIn.args();
 
 	const QString cmd = msgIn.cmd();
-	if( cmd == ItalcCore::GetUserInformation )
+	bool replied = false;
+	switch( msgIn.cmdId() )
 	{
-		static QString lastUserName, lastFullUsername;
-
-		LocalSystem::User user = LocalSystem::User::loggedOnUser();
-		QString currentUsername = user.name();
-		if( lastUserName != currentUsername )
-		{
-			lastUserName = currentUsername;
-			lastFullUsername = user.fullName();
-		}
-		if( !lastFullUsername.isEmpty() &&
-				currentUsername != lastFullUsername )
+		case ItalcCore::GetUserInformationId:
 		{
-			currentUsername = QString( "%1 (%2)" ).arg( currentUsername ).
-									arg( lastFullUsername );
+			QString userName, homeDir;
+			loggedOnUserInformation( &userName, &homeDir );
+			reply( &sdev, msgIn, ItalcCore::UserInformation ).
+						addArg( "username", userName ).
+						addArg( "homedir", homeDir ).
+										send();
+			replied = true;
+			break;
 		}
-		ItalcCore::Msg( &sdev, ItalcCore::UserInformation ).
-					addArg( "username", currentUsername ).
-					addArg( "homedir", user.homePath() ).
-									send();
-	}
-	else if( cmd == ItalcCore::ExecCmds )
-	{
-		const QString cmds = msgIn.arg( "cmds" );
-		if( !cmds.isEmpty() )
+		case ItalcCore::ExecCmdsId:
 		{
-			LocalSystem::User user = LocalSystem::User::loggedOnUser();
-			LocalSystem::Process proc(
-				LocalSystem::Process::findProcessId( QString(), -1, &user ) );
-
-			foreach( const QString & cmd, cmds.split( '\n' ) )
+			const QString cmds = msgIn.arg( "cmds" );
+			if( !cmds.isEmpty() )
 			{
-				LocalSystem::Process::Handle hProcess =
-					proc.runAsUser( cmd,
-						LocalSystem::Desktop::activeDesktop().name() );
-#ifdef ITALC_BUILD_WIN32
-				if( hProcess )
+				LocalSystem::User user = LocalSystem::User::loggedOnUser();
+				LocalSystem::Process proc(
+					LocalSystem::Process::findProcessId( QString(), -1, &user ) );
+
+				foreach( const QString & cmd, cmds.split( '\n' ) )
 				{
-					CloseHandle( hProcess );
-				}
+					LocalSystem::Process::Handle hProcess =
+						proc.runAsUser( cmd,
+							LocalSystem::Desktop::activeDesktop().name() );
+#ifdef ITALC_BUILD_WIN32
+					if( hProcess )
+					{
+						CloseHandle( hProcess );
+					}
 #else
-				(void) hProcess;
+					(void) hProcess;
 #endif
+				}
 			}
+			break;
 		}
-	}
-	else if( cmd == ItalcCore::LogonUserCmd )
-	{
-		LocalSystem::logonUser( msgIn.arg( "uname" ),
-					msgIn.arg( "passwd" ),
-					msgIn.arg( "domain" ) );
-	}
-	else if( cmd == ItalcCore::LogoutUser )
-	{
-		LocalSystem::logoutUser();
-	}
-	else if( cmd == ItalcCore::PowerOnComputer )
-	{
-		LocalSystem::broadcastWOLPacket( msgIn.arg( "mac" ) );
-	}
-	else if( cmd == ItalcCore::PowerDownComputer )
-	{
-		LocalSystem::powerDown();
-	}
-	else if( cmd == ItalcCore::RestartComputer )
-	{
-		LocalSystem::reboot();
-	}
-	else if( cmd == ItalcCore::DisableLocalInputs )
-	{
-		// TODO
-		//LocalSystem::disableLocalInputs( msgIn.arg( "disabled" ).toInt() );
-	}
-	else if( cmd == ItalcCore::SetRole )
-	{
-		const int role = msgIn.arg( "role" ).toInt();
-		if( role > ItalcCore::RoleNone && role < ItalcCore::RoleCount )
+		case ItalcCore::LogonUserId:
+			LocalSystem::logonUser( msgIn.arg( "uname" ),
+						msgIn.arg( "passwd" ),
+						msgIn.arg( "domain" ) );
+			break;
+		case ItalcCore::LogoutUserId:
+			LocalSystem::logoutUser();
+			break;
+		case ItalcCore::PowerOnComputerId:
+			LocalSystem::broadcastWOLPacket( msgIn.arg( "mac" ) );
+			break;
+		case ItalcCore::PowerDownComputerId:
+			LocalSystem::powerDown();
+			break;
+		case ItalcCore::RestartComputerId:
+			LocalSystem::reboot();
+			break;
+		case ItalcCore::DisableLocalInputsId:
+			// TODO
+			//LocalSystem::disableLocalInputs( msgIn.arg( "disabled" ).toInt() );
+			break;
+		case ItalcCore::SetRoleId:
 		{
-			ItalcCore::role = static_cast<ItalcCore::UserRoles>( role );
+			const int role = msgIn.arg( "role" ).toInt();
+			if( role > ItalcCore::RoleNone && role < ItalcCore::RoleCount )
+			{
+				ItalcCore::role = static_cast<ItalcCore::UserRoles>( role );
+			}
+			break;
 		}
-	}
-	else if( cmd == ItalcCore::StartDemo )
-	{
-		QString host = msgIn.arg( "host" );
-		QString port = msgIn.arg( "port" );
-		// no host given?
-		if( host.isEmpty() )
+		case ItalcCore::StartDemoId:
 		{
-			// then guess IP from remote peer address
-			const int MAX_HOST_LEN = 255;
-			char hostArr[MAX_HOST_LEN+1];
-			sock( hostArr, MAX_HOST_LEN, SocketGetPeerAddress, user );
-			hostArr[MAX_HOST_LEN] = 0;
-			host = hostArr;
+			QString host = msgIn.arg( "host" );
+			QString port = msgIn.arg( "port" );
+			// no host given?
+			if( host.isEmpty() )
+			{
+				// then guess IP from remote peer address
+				const int MAX_HOST_LEN = 255;
+				char hostArr[MAX_HOST_LEN+1];
+				sock( hostArr, MAX_HOST_LEN, SocketGetPeerAddress, user );
+				hostArr[MAX_HOST_LEN] = 0;
+				host = hostArr;
+			}
+			if( port.isEmpty() )
+			{
+				port = QString::number( PortOffsetDemoServer );
+			}
+			if( !host.contains( ':' ) )
+			{
+				host += ':' + port;
+			}
+			m_slaveManager.startDemo( host, msgIn.arg( "fullscreen" ).toInt() );
+			break;
 		}
-		if( port.isEmpty() )
+		case ItalcCore::StopDemoId:
+			m_slaveManager.stopDemo();
+			break;
+		case ItalcCore::DisplayTextMessageId:
+			m_slaveManager.messageBox( msgIn.arg( "title" ), msgIn.arg( "text" ) );
+			break;
+		case ItalcCore::LockScreenId:
+			m_slaveManager.lockScreen();
+			break;
+		case ItalcCore::UnlockScreenId:
+			m_slaveManager.unlockScreen();
+			break;
+		case ItalcCore::LockInputId:
+			m_slaveManager.lockInput();
+			break;
+		case ItalcCore::UnlockInputId:
+			m_slaveManager.unlockInput();
+			break;
+		case ItalcCore::StartDemoServerId:
+			ItalcCore::authenticationCredentials->setCommonSecret(
+										DsaKey::generateChallenge().toBase64() );
+			m_slaveManager.demoServerMaster()->start(
+				msgIn.arg( "sourceport" ).toInt(),
+				msgIn.arg( "destinationport" ).toInt() );
+			break;
+		case ItalcCore::StopDemoServerId:
+			m_slaveManager.demoServerMaster()->stop();
+			break;
+		case ItalcCore::DemoServerAllowHostId:
+			m_slaveManager.demoServerMaster()->allowHost( msgIn.arg( "host" ) );
+			break;
+		case ItalcCore::DemoServerUnallowHostId:
+			m_slaveManager.demoServerMaster()->unallowHost( msgIn.arg( "host" ) );
+			break;
+		case ItalcCore::ReportSlaveStateFlagsId:
+			reply( &sdev, msgIn, cmd ).
+					addArg( "slavestateflags", m_slaveManager.slaveStateFlags() ).
+						send();
+			replied = true;
+			break;
+		case ItalcCore::SetThumbnailSizeId:
 		{
-			port = QString::number( PortOffsetDemoServer );
+			// a width or height <= 0 switches back to full resolution
+			int size[2] = { msgIn.arg( "width" ).toInt(),
+							msgIn.arg( "height" ).toInt() };
+			sock( (char *) size, sizeof( size ), SocketSetScaledSize, user );
+			break;
 		}
-		if( !host.contains( ':' ) )
+		case ItalcCore::VerifyFramebufferId:
 		{
-			host += ':' + port;
+			const QVector<quint32> hashes = FramebufferTileHashes::fromByteArray(
+												msgIn.byteArrayArg( "hashes" ) );
+			const QBitArray lossyTiles = msgIn.arg( "lossytiles" ).toBitArray();
+			FramebufferTileHashes::Verification v;
+			v.tileSize = msgIn.arg( "tilesize" ).toInt();
+			v.width = msgIn.arg( "width" ).toInt();
+			v.height = msgIn.arg( "height" ).toInt();
+			v.tileCount = hashes.size();
+			v.hashes = hashes.constData();
+			v.lossyTiles = &lossyTiles;
+			v.differingTiles = 0;
+
+			// only answer if verification is supported so the master falls back
+			// to requesting full updates otherwise
+			if( sock( (char *) &v, sizeof( v ), SocketVerifyFramebuffer, user ) > 0 )
+			{
+				reply( &sdev, msgIn, cmd ).
+						addArg( "differingtiles", v.differingTiles ).
+							send();
+				replied = true;
+			}
+			break;
 		}
-		m_slaveManager.startDemo( host, msgIn.arg( "fullscreen" ).toInt() );
-	}
-	else if( cmd == ItalcCore::StopDemo )
-	{
-		m_slaveManager.stopDemo();
-	}
-	else if( cmd == ItalcCore::DisplayTextMessage )
-	{
-		m_slaveManager.messageBox( msgIn.arg( "title" ), msgIn.arg( "text" ) );
-	}
-	else if( cmd == ItalcCore::LockScreen )
-	{
-		m_slaveManager.lockScreen();
-	}
-	else if( cmd == ItalcCore::UnlockScreen )
-	{
-		m_slaveManager.unlockScreen();
-	}
-	else if( cmd == ItalcCore::LockInput )
-	{
-		m_slaveManager.lockInput();
-	}
-	else if( cmd == ItalcCore::UnlockInput )
-	{
-		m_slaveManager.unlockInput();
+		case ItalcCore::SubscribeNotificationsId:
+			// only answer if notifications can be delivered so the master
+			// keeps asking for changes otherwise
+			if( sock( NULL, 0, SocketSubscribeNotifications, user ) > 0 )
+			{
+				m_notificationMutex.lock();
+				m_notificationSubscribers[user].dispatcher = sock;
+				m_notificationSubscribers[user].framed =
+											msgIn.senderSupportsFraming();
+				m_notificationMutex.unlock();
+
+				// let master start with current state - we're running in the
+				// thread of the client connection here so have it sampled in
+				// the main thread which then flushes it to the new subscriber
+				QMetaObject::invokeMethod( this, "updateNotificationState",
+											Qt::QueuedConnection );
+
+				reply( &sdev, msgIn, cmd ).send();
+				replied = true;
+			}
+			break;
+		// TODO: handle plugins
+		default:
+			qCritical() << "ItalcCoreServer::handleItalcClientMessage(...): "
+					"could not handle cmd" << cmd;
+			// unhandled commands are not acknowledged
+			return true;
 	}
-	else if( cmd == ItalcCore::StartDemoServer )
+
+	// requests without an answer are acknowledged if the master asked for
+	// it by sending a request ID - older ones never do
+	if( replied == false && !msgIn.arg( "requestid" ).isEmpty() )
 	{
-		ItalcCore::authenticationCredentials->setCommonSecret(
-									DsaKey::generateChallenge().toBase64() );
-		m_slaveManager.demoServerMaster()->start(
-			msgIn.arg( "sourceport" ).toInt(),
-			msgIn.arg( "destinationport" ).toInt() );
+		reply( &sdev, msgIn, ItalcCore::Acknowledge ).send();
 	}
-	else if( cmd == ItalcCore::StopDemoServer )
+
+	return true;
+}
+
+
+
+
+void ItalcCoreServer::sendNotifications( socketDispatcher sd, void *user )
+{
+	m_notificationMutex.lock();
+
+	QHash<void *, NotificationSubscriber>::Iterator it =
+										m_notificationSubscribers.find( user );
+	if( it == m_notificationSubscribers.end() )
 	{
-		m_slaveManager.demoServerMaster()->stop();
+		m_notificationMutex.unlock();
+		return;
 	}
-	else if( cmd == ItalcCore::DemoServerAllowHost )
+
+	// remember what we're going to send so we can write to the socket
+	// without holding the lock
+	const bool framed = it->framed;
+	const bool sendUserInformation = it->userInformationSent == false ||
+										it->userName != m_userName ||
+										it->userHomeDir != m_userHomeDir;
+	const bool sendSlaveStateFlags = it->slaveStateFlags != m_slaveStateFlags;
+	const QString userName = m_userName;
+	const QString userHomeDir = m_userHomeDir;
+	const int slaveStateFlags = m_slaveStateFlags;
+
+	it->userInformationSent = true;
+	it->userName = userName;
+	it->userHomeDir = userHomeDir;
+	it->slaveStateFlags = slaveStateFlags;
+
+	m_notificationMutex.unlock();
+
+	SocketDevice sdev( sd, user );
+
+	// notifications are ordinary answers without a request ID
+	if( sendUserInformation )
 	{
-		m_slaveManager.demoServerMaster()->allowHost( msgIn.arg( "host" ) );
+		ItalcCore::Msg( &sdev, ItalcCore::UserInformation ).
+					setFramed( framed ).
+					addArg( "username", userName ).
+					addArg( "homedir", userHomeDir ).
+									send();
 	}
-	else if( cmd == ItalcCore::DemoServerUnallowHost )
+
+	if( sendSlaveStateFlags )
 	{
-		m_slaveManager.demoServerMaster()->unallowHost( msgIn.arg( "host" ) );
+		ItalcCore::Msg( &sdev, ItalcCore::ReportSlaveStateFlags ).
+					setFramed( framed ).
+					addArg( "slavestateflags", slaveStateFlags ).
+									send();
 	}
-	else if( cmd == ItalcCore::ReportSlaveStateFlags )
+}
+
+
+
+
+void ItalcCoreServer::unsubscribeNotifications( void *user )
+{
+	QMutexLocker l( &m_notificationMutex );
+	m_notificationSubscribers.remove( user );
+}
+
+
+
+
+void ItalcCoreServer::updateNotificationState()
+{
+	m_notificationMutex.lock();
+	const bool subscribed = m_notificationSubscribers.isEmpty() == false;
+	m_notificationMutex.unlock();
+
+	if( subscribed == false )
 	{
-		ItalcCore::Msg( &sdev, cmd ).
-				addArg( "slavestateflags", m_slaveManager.slaveStateFlags() ).
-					send();
+		return;
 	}
-	// TODO: handle plugins
-	else
+
+	QString userName, userHomeDir;
+	loggedOnUserInformation( &userName, &userHomeDir );
+
+	const int slaveStateFlags = m_slaveManager.slaveStateFlags();
+
+	QMutexLocker l( &m_notificationMutex );
+	m_userName = userName;
+	m_userHomeDir = userHomeDir;
+	m_slaveStateFlags = slaveStateFlags;
+
+	// notifications only go out after updates so make sure subscribers get
+	// one even if nothing changes on screen - subscribers are removed with
+	// this mutex held before their connection is gone
+	for( QHash<void *, NotificationSubscriber>::ConstIterator it =
+											m_notificationSubscribers.begin();
+			it != m_notificationSubscribers.end(); ++it )
 	{
-		qCritical() << "ItalcCoreServer::handleItalcClientMessage(...): "
-				"could not handle cmd" << cmd;
+		if( it->userInformationSent == false ||
+				it->userName != m_userName ||
+				it->userHomeDir != m_userHomeDir ||
+				it->slaveStateFlags != m_slaveStateFlags )
+		{
+			it->dispatcher( NULL, 0, SocketFlushNotifications, it.key() );
+		}
 	}
-
-	return true;
 }
 
 
 
+// runs in the threads of the individual client connections so only accesses
+// to shared data are serialized and authentications proceed in parallel
 bool ItalcCoreServer::authSecTypeItalc( socketDispatcher sd, void *user )
 {
-	QMutexLocker l( &m_dataMutex );
-
 	// find out IP of host - needed at several places
 	const int MAX_HOST_LEN = 255;
 	char host[MAX_HOST_LEN+1];
@@ -268,6 +484,7 @@ bool ItalcCoreServer::authSecTypeItalc( socketDispatcher sd, void *user )
 	{
 		supportedAuthTypes["ItalcAuthCommonSecret"] = ItalcAuthCommonSecret;
 	}
+	supportedAuthTypes["ItalcAuthTicket"] = ItalcAuthTicket;
 	sdev.write( supportedAuthTypes );
 
 	uint32_t result = rfbVncAuthFailed;
@@ -301,15 +518,21 @@ bool ItalcCoreServer::authSecTypeItalc( socketDispatcher sd, void *user )
 		case ItalcAuthDSA:
 			if( doKeyBasedAuth( sdev, host ) )
 			{
-				if( DesktopAccessPermission(
-						DesktopAccessPermission::KeyAuthentication ).
-							ask( username, host ) )
+				if( askAccessPermission( username, host ) )
 				{
 					result = rfbVncAuthOK;
 				}
 			}
 			break;
 
+		// authentication via ticket or DSA-challenge/-response
+		case ItalcAuthTicket:
+			if( doTicketAuth( sdev, host, username ) )
+			{
+				result = rfbVncAuthOK;
+			}
+			break;
+
 		case ItalcAuthCommonSecret:
 			if( doCommonSecretAuth( sdev ) )
 			{
@@ -325,8 +548,10 @@ bool ItalcCoreServer::authSecTypeItalc( socketDispatcher sd, void *user )
 	{
 		// only report about failed authentications for hosts that are not
 		// blacklisted already
-		if( !m_manuallyDeniedHosts.contains( host ) &&
-				chosen != ItalcAuthHostBased )
+		m_dataMutex.lock();
+		const bool deniedHost = m_manuallyDeniedHosts.contains( host );
+		m_dataMutex.unlock();
+		if( !deniedHost && chosen != ItalcAuthHostBased )
 		{
 			errorMsgAuth( host );
 		}
@@ -343,6 +568,8 @@ bool ItalcCoreServer::authSecTypeItalc( socketDispatcher sd, void *user )
 
 void ItalcCoreServer::errorMsgAuth( const QString &ip )
 {
+	QMutexLocker l( &_this->m_dataMutex );
+
 	if( _this->m_failedAuthHosts.contains( ip ) == false )
 	{
 		_this->m_failedAuthHosts += ip;
@@ -356,7 +583,8 @@ void ItalcCoreServer::errorMsgAuth( const QString &ip )
 
 
 
-bool ItalcCoreServer::doKeyBasedAuth( SocketDevice &sdev, const QString &host )
+bool ItalcCoreServer::doKeyBasedAuth( SocketDevice &sdev, const QString &host,
+										int *role )
 {
 	// generate data to sign and send to client
 	const QByteArray chall = DsaKey::generateChallenge();
@@ -395,12 +623,178 @@ bool ItalcCoreServer::doKeyBasedAuth( SocketDevice &sdev, const QString &host )
 	// under which the client claims to run
 	const QByteArray sig = sdev.read().toByteArray();
 
-	qDebug() << "Loading public key" << LocalSystem::Path::publicKeyPath( urole )
-				<< "for role" << urole;
-	// (publicKeyPath does range-checking of urole)
-	PublicDSAKey pubKey( LocalSystem::Path::publicKeyPath( urole ) );
+	const QSharedPointer<PublicDSAKey> pubKey = publicKey( urole );
+
+	// verifying is CPU bound so do not let more clients verify at once
+	// than there are cores when lots of them connect at the same time
+	m_signatureVerifications.acquire();
+	const bool valid = pubKey->verifySignature( chall, sig );
+	m_signatureVerifications.release();
+
+	if( role )
+	{
+		*role = urole;
+	}
+
+	return valid;
+}
+
+
+
+
+// loads public key of given role only if it has not been loaded before or
+// its file has been modified since then
+QSharedPointer<PublicDSAKey> ItalcCoreServer::publicKey( int role )
+{
+	// (publicKeyPath does range-checking of role)
+	return m_publicKeys.key( LocalSystem::Path::publicKeyPath(
+								static_cast<ItalcCore::UserRoles>( role ) ) );
+}
+
+
+
+
+bool ItalcCoreServer::doTicketAuth( SocketDevice &sdev, const QString &host,
+									const QString &username )
+{
+	const QByteArray ticket = sdev.read().toByteArray();
+	int role = sdev.read().toInt();
+
+	const bool validTicket = verifySessionTicket( ticket, host, role );
+	sdev.write( QVariant( validTicket ) );
+
+	// a ticket proves that the client signed a challenge recently so we can
+	// skip loading the public key and verifying a signature
+	const bool authenticated =
+		( validTicket || doKeyBasedAuth( sdev, host, &role ) ) &&
+			askAccessPermission( username, host );
+
+	// always answer as client waits for a new ticket
+	sdev.write( QVariant( authenticated ? issueSessionTicket( host, role ) :
+															QByteArray() ) );
+
+	return authenticated;
+}
+
+
+
+
+QByteArray ItalcCoreServer::issueSessionTicket( const QString &host,
+												int role ) const
+{
+	QByteArray nonce( SessionTicketNonceSize, 0 );
+	if( RAND_bytes( (unsigned char *) nonce.data(), nonce.size() ) != 1 )
+	{
+		// no ticket then - client signs a challenge next time
+		return QByteArray();
+	}
+
+	QByteArray ticket;
+	QDataStream( &ticket, QIODevice::WriteOnly ) <<
+		QDateTime::currentMSecsSinceEpoch() + SessionTicketLifetime <<
+			(qint32) role;
+
+	ticket += nonce;
+
+	return ticket + sessionTicketMac( ticket, host );
+}
+
+
+
+
+// tickets are only accepted once and only for the role they have been issued
+// for - the nonces of used tickets are kept until the tickets expire
+bool ItalcCoreServer::verifySessionTicket( const QByteArray &ticket,
+											const QString &host, int role )
+{
+	const int dataSize = sizeof( qint64 ) + sizeof( qint32 ) +
+												SessionTicketNonceSize;
+	if( ticket.size() <= dataSize )
+	{
+		return false;
+	}
+
+	const QByteArray data = ticket.left( dataSize );
+	const QByteArray mac = sessionTicketMac( data, host );
+	if( ticket.size() - dataSize != mac.size() )
+	{
+		return false;
+	}
+
+	// compare in constant time to not reveal anything about the MAC
+	char difference = 0;
+	for( int i = 0; i < mac.size(); ++i )
+	{
+		difference |= mac[i] ^ ticket[dataSize+i];
+	}
+	if( difference )
+	{
+		return false;
+	}
+
+	qint64 expiry = 0;
+	qint32 ticketRole = -1;
+	QDataStream( data ) >> expiry >> ticketRole;
+
+	const qint64 now = QDateTime::currentMSecsSinceEpoch();
+	if( now >= expiry || ticketRole != role )
+	{
+		return false;
+	}
+
+	const QByteArray nonce = data.right( SessionTicketNonceSize );
 
-	return pubKey.verifySignature( chall, sig );
+	QMutexLocker l( &m_dataMutex );
+
+	QHash<QByteArray, qint64>::Iterator it = m_usedSessionTickets.begin();
+	while( it != m_usedSessionTickets.end() )
+	{
+		if( it.value() <= now )
+		{
+			it = m_usedSessionTickets.erase( it );
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	if( m_usedSessionTickets.contains( nonce ) )
+	{
+		return false;
+	}
+
+	m_usedSessionTickets[nonce] = expiry;
+
+	return true;
+}
+
+
+
+
+// binds ticket to the address of the client it has been issued to
+QByteArray ItalcCoreServer::sessionTicketMac( const QByteArray &data,
+												const QString &host ) const
+{
+	QMessageAuthenticationCode mac( QCryptographicHash::Sha256,
+										m_sessionTicketKey );
+	mac.addData( data );
+	mac.addData( host.toUtf8() );
+
+	return mac.result();
+}
+
+
+
+
+// access dialogs are shown one after another
+bool ItalcCoreServer::askAccessPermission( const QString &username,
+											const QString &host )
+{
+	QMutexLocker l( &m_accessPermissionMutex );
+
+	return DesktopAccessPermission(
+				DesktopAccessPermission::KeyAuthentication ).ask( username, host );
 }
 
 
@@ -410,7 +804,11 @@ bool ItalcCoreServer::doHostBasedAuth( const QString &host )
 {
 	qDebug() << "ItalcCoreServer: doing host based auth for host" << host;
 
-	if( m_allowedIPs.isEmpty() )
+	m_dataMutex.lock();
+	const QStringList allowedIPs = m_allowedIPs;
+	m_dataMutex.unlock();
+
+	if( allowedIPs.isEmpty() )
 	{
 		qWarning() << "ItalcCoreServer: empty list of allowed IPs";
 		return false;
@@ -419,7 +817,7 @@ bool ItalcCoreServer::doHostBasedAuth( const QString &host )
 	// already valid IP?
 	if( QHostAddress().setAddress( host ) )
 	{
-		if( m_allowedIPs.contains( host ) )
+		if( allowedIPs.contains( host ) )
 		{
 			return true;
 		}
@@ -432,7 +830,7 @@ bool ItalcCoreServer::doHostBasedAuth( const QString &host )
 		// check each address for existence in list of allowed clients
 		foreach( const QHostAddress a, addr )
 		{
-			if( m_allowedIPs.contains( a.toString() ) ||
+			if( allowedIPs.contains( a.toString() ) ||
 					a.toString() == QHostAddress( QHostAddress::LocalHost ).
 																	toString() )
 			{
@@ -25,12 +25,18 @@
 #ifndef ITALC_CORE_SERVER_H
 #define ITALC_CORE_SERVER_H
 
+#include <QtCore/QHash>
 #include <QtCore/QMutex>
+#include <QtCore/QSemaphore>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QStringList>
+#include <QtCore/QTimer>
 
 #include "SocketDevice.h"
 #include "ItalcSlaveManager.h"
+#include "PublicKeyCache.h"
 
+class PublicDSAKey;
 
 class ItalcCoreServer : public QObject
 {
@@ -47,6 +53,11 @@ public:
 
 	int handleItalcClientMessage( socketDispatcher sd, void *user );
 
+	// pushes changes of logged on user and slave states to given client if
+	// it subscribed to them - see SocketSubscribeNotifications
+	void sendNotifications( socketDispatcher sd, void *user );
+	void unsubscribeNotifications( void *user );
+
 	bool authSecTypeItalc( socketDispatcher sd, void *user );
 
 	ItalcSlaveManager * slaveManager()
@@ -61,13 +72,60 @@ public:
 	}
 
 
+private slots:
+	void updateNotificationState();
+
+
 private:
+	enum {
+		// how long a client may authenticate with a ticket instead of
+		// signing a challenge
+		SessionTicketLifetime = 10*60*1000,
+		// size of random part making each ticket unique
+		SessionTicketNonceSize = 16,
+		// interval (in ms) in which state pushed to subscribers is sampled
+		NotificationStateInterval = 1000
+	} ;
+
+	// state last sent to a client subscribed to notifications
+	struct NotificationSubscriber
+	{
+		NotificationSubscriber() :
+			dispatcher( NULL ),
+			framed( false ),
+			userInformationSent( false ),
+			userName(),
+			userHomeDir(),
+			slaveStateFlags( -1 )
+		{
+		}
+
+		socketDispatcher dispatcher;
+		bool framed;
+		bool userInformationSent;
+		QString userName;
+		QString userHomeDir;
+		int slaveStateFlags;
+	} ;
+
 	static void errorMsgAuth( const QString & _ip );
 
-	bool doKeyBasedAuth( SocketDevice &sdev, const QString &host );
+	QSharedPointer<PublicDSAKey> publicKey( int role );
+
+	bool doKeyBasedAuth( SocketDevice &sdev, const QString &host,
+							int *role = NULL );
+	bool doTicketAuth( SocketDevice &sdev, const QString &host,
+						const QString &username );
+	bool askAccessPermission( const QString &username, const QString &host );
 	bool doHostBasedAuth( const QString &host );
 	bool doCommonSecretAuth( SocketDevice &sdev );
 
+	QByteArray issueSessionTicket( const QString &host, int role ) const;
+	bool verifySessionTicket( const QByteArray &ticket, const QString &host,
+								int role );
+	QByteArray sessionTicketMac( const QByteArray &data,
+									const QString &host ) const;
+
 	static ItalcCoreServer *_this;
 
 	QMutex m_dataMutex;
@@ -80,6 +138,24 @@ private:
 
 	QStringList m_failedAuthHosts;
 
+	PublicKeyCache m_publicKeys;
+
+	// tickets are only valid as long as we're running
+	QByteArray m_sessionTicketKey;
+	// nonces of tickets used already mapped to their expiry
+	QHash<QByteArray, qint64> m_usedSessionTickets;
+
+	QMutex m_accessPermissionMutex;
+	QSemaphore m_signatureVerifications;
+
+	// protects sampled state and subscribers
+	QMutex m_notificationMutex;
+	QString m_userName;
+	QString m_userHomeDir;
+	int m_slaveStateFlags;
+	QHash<void *, NotificationSubscriber> m_notificationSubscribers;
+	QTimer m_notificationTimer;
+
 	ItalcSlaveManager m_slaveManager;
 
 } ;
@@ -57,6 +57,7 @@ const Ipc::Command ItalcSlaveManager::DemoServer::StartDemoServer = "StartDemoSe
 const Ipc::Argument ItalcSlaveManager::DemoServer::SourcePort = "SourcePort";
 const Ipc::Argument ItalcSlaveManager::DemoServer::DestinationPort = "DestinationPort";
 const Ipc::Argument ItalcSlaveManager::DemoServer::CommonSecret = "CommonSecret";
+const Ipc::Argument ItalcSlaveManager::DemoServer::SharedFramebuffer = "SharedFramebuffer";
 
 const Ipc::Command ItalcSlaveManager::DemoServer::UpdateAllowedHosts = "UpdateAllowedHosts";
 const Ipc::Argument ItalcSlaveManager::DemoServer::AllowedHosts = "AllowedHosts";
@@ -77,6 +77,7 @@ public:
 		static const Ipc::Argument SourcePort;
 		static const Ipc::Argument DestinationPort;
 		static const Ipc::Argument CommonSecret;
+		static const Ipc::Argument SharedFramebuffer;
 
 		static const Ipc::Command UpdateAllowedHosts;
 		static const Ipc::Argument AllowedHosts;
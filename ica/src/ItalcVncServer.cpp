@@ -44,21 +44,226 @@ extern "C"
 
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDir>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
 #include <QtCore/QProcess>
 
 #include "ItalcVncServer.h"
 #include "ItalcConfiguration.h"
 #include "ItalcCore.h"
 #include "ItalcCoreServer.h"
+#include "FramebufferTileHashes.h"
 #include "ItalcRfbExt.h"
 #include "Logger.h"
 #include "LogonAuthentication.h"
+#include "SharedFramebuffer.h"
 
 
 extern "C" int x11vnc_main( int argc, char * * argv );
 
 
 
+// exports framebuffer of x11vnc to demo server slave - only set up if the
+// built-in demo server is used
+static SharedFramebufferWriter *__sharedFramebuffer = NULL;
+
+#ifdef ITALC_BUILD_LINUX
+static void exportModifiedFramebuffer( rfbScreenInfoPtr screen,
+										sraRegionPtr region )
+{
+	__sharedFramebuffer->update( screen, region );
+}
+#endif
+
+
+
+extern "C" void rfbScalingSetup( rfbClientPtr cl, int width, int height );
+extern "C" int rfbSendNewScaleSize( rfbClientPtr cl );
+
+
+// lets libvncserver send a downscaled version of the framebuffer to given
+// client so that it still covers the requested size - only integral factors
+// are used so each pixel sent is the average of whole source pixels
+static void scaleFramebuffer( rfbClientPtr cl, int width, int height )
+{
+	int factor = 1;
+	if( width > 0 && height > 0 )
+	{
+		factor = qMax( 1, qMin( cl->screen->width / width,
+								cl->screen->height / height ) );
+	}
+
+	const int scaledWidth = cl->screen->width / factor;
+	const int scaledHeight = cl->screen->height / factor;
+
+	if( cl->scaledScreen->width != scaledWidth ||
+			cl->scaledScreen->height != scaledHeight )
+	{
+		rfbScalingSetup( cl, scaledWidth, scaledHeight );
+		rfbSendNewScaleSize( cl );
+	}
+}
+
+
+
+// compares hashes of tiles the master has with the framebuffer as it would
+// be sent to given client and marks differing tiles as modified so they are
+// sent with the next update
+static void verifyFramebuffer( rfbClientPtr cl,
+								FramebufferTileHashes::Verification *v )
+{
+	rfbScreenInfoPtr screen = cl->screen;
+	rfbScreenInfoPtr scaled = cl->scaledScreen;
+	const int w = scaled->width;
+	const int h = scaled->height;
+	const int tileSize = v->tileSize;
+
+	sraRegionPtr modified = sraRgnCreate();
+	v->differingTiles = 0;
+
+	if( cl->format.bitsPerPixel != 32 || v->width != w || v->height != h ||
+			tileSize != FramebufferTileHashes::TileSize ||
+			v->tileCount != FramebufferTileHashes::tileCount( w, h, tileSize ) )
+	{
+		// master is out of sync so it needs everything
+		sraRegionPtr r = sraRgnCreateRect( 0, 0, screen->width, screen->height );
+		sraRgnOr( modified, r );
+		sraRgnDestroy( r );
+		v->differingTiles = qMax( 1, v->tileCount );
+	}
+	else
+	{
+		const quint32 mask = FramebufferTileHashes::colorMask( cl->format );
+		const bool skipLossy = v->lossyTiles->size() == v->tileCount;
+		QVector<char> row( w * 4 * tileSize );
+
+		int tile = 0;
+		for( int y = 0; y < h; y += tileSize )
+		{
+			// hashes refer to pixels in the format of the client
+			const int th = qMin( tileSize, h - y );
+			cl->translateFn( cl->translateLookupTable, &screen->serverFormat,
+								&cl->format,
+								scaled->frameBuffer + y * scaled->paddedWidthInBytes,
+								row.data(), scaled->paddedWidthInBytes, w, th );
+
+			for( int x = 0; x < w; x += tileSize, ++tile )
+			{
+				const int tw = qMin( tileSize, w - x );
+				if( ( skipLossy && v->lossyTiles->testBit( tile ) ) ||
+						FramebufferTileHashes::hashTile(
+							(const uchar *) row.constData() + x * 4, w * 4,
+												tw, th, mask ) == v->hashes[tile] )
+				{
+					continue;
+				}
+
+				// modified region refers to unscaled framebuffer
+				sraRegionPtr r = sraRgnCreateRect(
+						x * screen->width / w,
+						y * screen->height / h,
+						( ( x + tw ) * screen->width + w - 1 ) / w,
+						( ( y + th ) * screen->height + h - 1 ) / h );
+				sraRgnOr( modified, r );
+				sraRgnDestroy( r );
+				++v->differingTiles;
+			}
+		}
+	}
+
+	if( v->differingTiles > 0 )
+	{
+		LOCK( cl->updateMutex );
+		sraRgnOr( cl->modifiedRegion, modified );
+		TSIGNAL( cl->updateCond );
+		UNLOCK( cl->updateMutex );
+	}
+
+	sraRgnDestroy( modified );
+}
+
+
+
+// clients subscribed to notifications and their hooks we replaced
+static QMutex __notificationClientsMutex;
+static QHash<rfbClientPtr, ClientGoneHookPtr> __notificationClients;
+static rfbDisplayFinishedHookPtr __displayFinishedHook = NULL;
+
+qint64 libvncServerDispatcher( char * _buf, const qint64 _len,
+				const SocketOpCodes _op_code, void * _user );
+
+
+// called after an update has been sent to a client which is the only time
+// we can be sure the message stream is not in the middle of an update
+static void sendNotifications( rfbClientPtr cl, int result )
+{
+	if( __displayFinishedHook )
+	{
+		__displayFinishedHook( cl, result );
+	}
+
+	if( result )
+	{
+		ItalcCoreServer::instance()->sendNotifications( libvncServerDispatcher,
+																		cl );
+	}
+}
+
+
+
+static void notificationClientGone( rfbClientPtr cl )
+{
+	ItalcCoreServer::instance()->unsubscribeNotifications( cl );
+
+	__notificationClientsMutex.lock();
+	ClientGoneHookPtr clientGoneHook = __notificationClients.take( cl );
+	__notificationClientsMutex.unlock();
+
+	if( clientGoneHook )
+	{
+		clientGoneHook( cl );
+	}
+}
+
+
+
+// notifications are sent along with framebuffer updates which masters
+// request all the time
+static void subscribeNotifications( rfbClientPtr cl )
+{
+	QMutexLocker l( &__notificationClientsMutex );
+
+	if( __notificationClients.contains( cl ) == false )
+	{
+		__notificationClients[cl] = cl->clientGoneHook;
+		cl->clientGoneHook = notificationClientGone;
+	}
+
+	if( cl->screen->displayFinishedHook != sendNotifications )
+	{
+		__displayFinishedHook = cl->screen->displayFinishedHook;
+		cl->screen->displayFinishedHook = sendNotifications;
+	}
+}
+
+
+
+// marks a single pixel as modified so the client gets an update as soon as
+// it asks for one and sendNotifications() is called afterwards
+static void flushNotifications( rfbClientPtr cl )
+{
+	sraRegionPtr r = sraRgnCreateRect( 0, 0, 1, 1 );
+
+	LOCK( cl->updateMutex );
+	sraRgnOr( cl->modifiedRegion, r );
+	TSIGNAL( cl->updateCond );
+	UNLOCK( cl->updateMutex );
+
+	sraRgnDestroy( r );
+}
+
+
+
 qint64 libvncServerDispatcher( char * _buf, const qint64 _len,
 				const SocketOpCodes _op_code, void * _user )
 {
@@ -72,6 +277,19 @@ qint64 libvncServerDispatcher( char * _buf, const qint64 _len,
 		case SocketGetPeerAddress:
 			strncpy( _buf, cl->host, _len );
 			break;
+		case SocketSetScaledSize:
+			scaleFramebuffer( cl, ( (int *) _buf )[0], ( (int *) _buf )[1] );
+			break;
+		case SocketVerifyFramebuffer:
+			verifyFramebuffer( cl,
+						(FramebufferTileHashes::Verification *) _buf );
+			return 1;
+		case SocketSubscribeNotifications:
+			subscribeNotifications( cl );
+			return 1;
+		case SocketFlushNotifications:
+			flushNotifications( cl );
+			return 1;
 	}
 	return 0;
 
@@ -216,6 +434,12 @@ ItalcVncServer::ItalcVncServer() :
 
 ItalcVncServer::~ItalcVncServer()
 {
+	// x11vnc still might be running so just make sure the segment does
+	// not persist after we're gone
+	if( __sharedFramebuffer )
+	{
+		__sharedFramebuffer->unlink();
+	}
 }
 
 
@@ -344,6 +568,13 @@ void ItalcVncServer::run()
 		}
 	}
 
+	if( ItalcCore::config->demoServerBackend() != 0 )
+	{
+		__sharedFramebuffer =
+			new SharedFramebufferWriter( SharedFramebuffer::segmentName() );
+		rfbFramebufferModified = exportModifiedFramebuffer;
+	}
+
 	runX11vnc( cmdline, m_port, false );
 
 #elif ITALC_BUILD_WIN32
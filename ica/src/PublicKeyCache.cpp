@@ -0,0 +1,68 @@
+/*
+ * PublicKeyCache.cpp - implementation of PublicKeyCache
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <QtCore/QDebug>
+#include <QtCore/QFileInfo>
+
+#include "PublicKeyCache.h"
+#include "DsaKey.h"
+
+
+
+PublicKeyCache::PublicKeyCache() :
+	m_mutex(),
+	m_keys()
+{
+}
+
+
+
+
+PublicKeyCache::~PublicKeyCache()
+{
+}
+
+
+
+
+QSharedPointer<PublicDSAKey> PublicKeyCache::key( const QString &path )
+{
+	const QFileInfo info( path );
+
+	QMutexLocker l( &m_mutex );
+
+	CachedKey &cached = m_keys[path];
+	if( cached.key.isNull() ||
+			cached.lastModified != info.lastModified() ||
+			cached.size != info.size() )
+	{
+		qDebug() << "Loading public key" << path;
+
+		cached.key = QSharedPointer<PublicDSAKey>( new PublicDSAKey( path ) );
+		cached.lastModified = info.lastModified();
+		cached.size = info.size();
+	}
+
+	return cached.key;
+}
@@ -0,0 +1,69 @@
+/*
+ * PublicKeyCache.h - cache for public keys of user roles
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef PUBLIC_KEY_CACHE_H
+#define PUBLIC_KEY_CACHE_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+
+class PublicDSAKey;
+
+// keeps public keys loaded so they only have to be read and parsed again
+// after the key file has been modified - used by ItalcCoreServer for each
+// key based authentication, therefore thread-safe
+class PublicKeyCache
+{
+public:
+	PublicKeyCache();
+	~PublicKeyCache();
+
+	QSharedPointer<PublicDSAKey> key( const QString &path );
+
+
+private:
+	// key as loaded from file at last modification time
+	struct CachedKey
+	{
+		CachedKey() :
+			key(),
+			lastModified(),
+			size( -1 )
+		{
+		}
+
+		QSharedPointer<PublicDSAKey> key;
+		QDateTime lastModified;
+		qint64 size;
+	} ;
+
+	QMutex m_mutex;
+	QHash<QString, CachedKey> m_keys;
+
+} ;
+
+#endif
@@ -23,9 +23,11 @@
  */
 
 #include "RfbLZORLE.h"
+#include "RfbLZORLEKernels.h"
 
 #include "minilzo.h"
 
+#include <QtCore/QThreadStorage>
 #include <QtGui/QColor>
 
 #include <rfb/rfb.h>
@@ -45,6 +47,14 @@ static void CopyRectangle( rfbClient* client, uint8_t* buffer, int x, int y, int
 
 static bool handleRaw( rfbClient *c, int rx, int ry, int rw, int rh )
 {
+	// lines of full-width rectangles are contiguous in framebuffer so we can
+	// read them directly without copying
+	if( rx == 0 && rw == c->width && ry + rh <= c->height )
+	{
+		return ReadFromRFBServer( c, (char *) c->frameBuffer +
+								ry * c->width * 4, rw * rh * 4 );
+	}
+
 	int y=ry, h=rh;
 	int bytesPerLine = rw * c->format.bitsPerPixel / 8;
 	int linesToRead = RFB_BUFFER_SIZE / bytesPerLine;
@@ -68,16 +78,36 @@ static bool handleRaw( rfbClient *c, int rx, int ry, int rw, int rh )
 
 
 
+// makes sure given per-connection buffer of rfbClient holds at least size
+// bytes - buffers are allocated with malloc() as they're freed by
+// rfbClientCleanup()
+static char *reserveBuffer( char **buffer, int *bufferSize, uint32_t size )
+{
+	if( *buffer == NULL || *bufferSize < (int) size )
+	{
+		free( *buffer );
+		*bufferSize = size;
+		*buffer = (char *) malloc( *bufferSize );
+	}
+
+	return *buffer;
+}
+
+
+
 static rfbBool handleEncodingLZORLE( rfbClient *c,
 										rfbFramebufferUpdateRectHeader *r )
 {
-	if( r->encoding != rfbEncodingLZORLE )
+	if( r->encoding != rfbEncodingLZORLE &&
+			r->encoding != rfbEncodingLZORLEDelta )
 	{
 		return false;
 	}
 
-	uint16_t rx = r->r.x;
-	uint16_t ry = r->r.y;
+	const bool delta = r->encoding == rfbEncodingLZORLEDelta;
+
+	const uint16_t rx = r->r.x;
+	const uint16_t ry = r->r.y;
 	const uint16_t rw = r->r.w;
 	const uint16_t rh = r->r.h;
 
@@ -90,23 +120,45 @@ static rfbBool handleEncodingLZORLE( rfbClient *c,
 
 	if( !hdr.compressed )
 	{
+		if( delta )
+		{
+			// the server always compresses delta rectangles
+			qCritical( "handleEncodingLZORLE(...): uncompressed delta" );
+			return false;
+		}
 		return handleRaw( c, rx, ry, rw, rh );
 	}
 
 	hdr.bytesLZO = Swap32IfLE( hdr.bytesLZO );
 	hdr.bytesRLE = Swap32IfLE( hdr.bytesRLE );
 
-	uint8_t *lzo_data = new uint8_t[hdr.bytesLZO];
+	// RLE data never is bigger than raw pixel data and LZO data never
+	// exceeds the worst case expansion of LZO
+	if( hdr.bytesRLE > (uint32_t) rw * rh * 4 ||
+			hdr.bytesLZO > hdr.bytesRLE + hdr.bytesRLE / 16 + 67 )
+	{
+		qCritical( "handleEncodingLZORLE(...): invalid header" );
+		return false;
+	}
+
+	// the buffers of the Ultra encoding are re-used so we do not have to
+	// allocate memory for every single rectangle
+	uint8_t *lzo_data = (uint8_t *) reserveBuffer( &c->ultra_buffer,
+										&c->ultra_buffer_size, hdr.bytesLZO );
+	uint8_t *rle_data = (uint8_t *) reserveBuffer( &c->raw_buffer,
+										&c->raw_buffer_size, hdr.bytesRLE );
+	if( lzo_data == NULL || rle_data == NULL )
+	{
+		qCritical( "handleEncodingLZORLE(...): could not allocate buffers" );
+		return false;
+	}
 
 	if( !ReadFromRFBServer( c, (char *) lzo_data, hdr.bytesLZO ) )
 	{
 		qWarning( "failed reading LZO data from server" );
-		delete[] lzo_data;
 		return false;
 	}
 
-	uint8_t *rle_data = new uint8_t[hdr.bytesRLE];
-
 	lzo_uint decomp_bytes = hdr.bytesRLE;
 	lzo1x_decompress_safe( (const unsigned char *) lzo_data,
 				(lzo_uint) hdr.bytesLZO,
@@ -114,31 +166,225 @@ static rfbBool handleEncodingLZORLE( rfbClient *c,
 				(lzo_uint *) &decomp_bytes, NULL );
 	if( decomp_bytes != hdr.bytesRLE )
 	{
-		delete[] rle_data;
-		delete[] lzo_data;
 		qCritical( "handleEncodingLZORLE(...): expected and real "
 					"size of decompressed data do not match!" );
 		return false;
 	}
 
-	QRgb *dst = ( (QRgb *) c->frameBuffer ) + c->width*ry + rx;
+	RfbLZORLE::expandRuns( rle_data, hdr.bytesRLE, delta,
+							QRect( rx, ry, rw, rh ),
+							(uint32_t *) c->frameBuffer, c->width, c->height );
+
+	return true;
+}
+
+
+
+
+// we only compress if it's enough data, otherwise there's too much overhead
+#define RAW_MAX_PIXELS 1024
+
+
+// per-thread scratch buffers used by RfbLZORLE::encodeRect() so encoder
+// threads do not have to allocate memory for every single rectangle
+struct LZORLEEncoderBuffers
+{
+	LZORLEEncoderBuffers() :
+		lzoWorkMem( new lzo_align_t[( LZO1X_1_MEM_COMPRESS +
+						( sizeof( lzo_align_t ) - 1 ) ) / sizeof( lzo_align_t )] ),
+		rleBuf( NULL ),
+		rleBufSize( 0 ),
+		deltaImage()
+	{
+	}
+
+	~LZORLEEncoderBuffers()
+	{
+		delete[] rleBuf;
+		delete[] lzoWorkMem;
+	}
+
+	uint8_t *rleBuffer( size_t size )
+	{
+		// re-allocate RLE buffer if current one is too small
+		if( size > rleBufSize )
+		{
+			delete[] rleBuf;
+			rleBuf = new uint8_t[size];
+			rleBufSize = size;
+		}
+		return rleBuf;
+	}
+
+	lzo_align_t *lzoWorkMem;
+	uint8_t *rleBuf;
+	size_t rleBufSize;
+	QImage deltaImage;
+
+} ;
+
+static QThreadStorage<LZORLEEncoderBuffers *> __encoderBuffers;
+
+
+
+// encodes given rectangle of image but announces it at pos - raw encoding
+// of small rectangles can be disabled if the encoding requires compression
+static void encodeLZORLE( const QImage &image, const QRect &rect,
+							const QPoint &pos, uint32_t encoding,
+							bool allowRaw, bool otherEndianess,
+							QByteArray &out )
+{
+	const int rx = rect.x();
+	const int ry = rect.y();
+	const int rw = rect.width();
+	const int rh = rect.height();
+
+	const rfbRectangle rr =
+	{
+		(uint16_t) Swap16IfLE( pos.x() ),
+		(uint16_t) Swap16IfLE( pos.y() ),
+		(uint16_t) Swap16IfLE( rw ),
+		(uint16_t) Swap16IfLE( rh )
+	} ;
+
+	const rfbFramebufferUpdateRectHeader rhdr =
+	{
+		rr,
+		(uint32_t) Swap32IfLE( encoding )
+	} ;
+
+	out.append( (const char *) &rhdr, sizeof( rhdr ) );
+
+	RfbLZORLE::Header hdr = { 0, 0, 0 } ;
+
+	if( allowRaw && rw * rh <= RAW_MAX_PIXELS )
+	{
+		out.append( (const char *) &hdr, sizeof( hdr ) );
+
+		const int offset = out.size();
+		out.resize( offset + rw * rh * sizeof( QRgb ) );
+
+		QRgb *dst = (QRgb *)( out.data() + offset );
+		for( int y = 0; y < rh; ++y )
+		{
+			const QRgb *src = (const QRgb *) image.scanLine( ry + y ) + rx;
+			if( otherEndianess )
+			{
+				for( int x = 0; x < rw; ++x, ++src, ++dst )
+				{
+					*dst = Swap32( *src );
+				}
+			}
+			else
+			{
+				memcpy( dst, src, rw * sizeof( QRgb ) );
+				dst += rw;
+			}
+		}
+		return;
+	}
+
+	if( !__encoderBuffers.hasLocalData() )
+	{
+		__encoderBuffers.setLocalData( new LZORLEEncoderBuffers );
+	}
+	LZORLEEncoderBuffers *buffers = __encoderBuffers.localData();
+
+	hdr.compressed = 1;
+	QRgb last_pix = *( (const QRgb *) image.scanLine( ry ) + rx );
+
+	uint8_t rle_cnt = 0;
+	uint8_t rle_sub = 1;
+	uint8_t *out_rle = buffers->rleBuffer( rw * rh * sizeof( QRgb ) + 16 );
+	uint8_t *out_ptr = out_rle;
+	for( int y = ry; y < ry+rh; ++y )
+	{
+		const QRgb * data = ( (const QRgb *) image.scanLine( y ) ) + rx;
+		int x = 0;
+		while( x < rw )
+		{
+			// skip all pixels continuing current run (at most 255)
+			const int n = RfbLZORLEKernels::matchingPixels( data + x,
+												qMin( rw - x, 255 - rle_cnt ),
+												last_pix );
+			rle_cnt += n;
+			x += n;
+			if( x < rw )
+			{
+				*( (QRgb *) out_ptr ) = Swap32IfBE( last_pix );
+				*( out_ptr + 3 ) = rle_cnt - rle_sub;
+				out_ptr += 4;
+				last_pix = data[x];
+				rle_cnt = rle_sub = 0;
+				++x;
+			}
+		}
+	}
+
+	// flush RLE-loop
+	*( (QRgb *) out_ptr ) = Swap32IfBE( last_pix );
+	*( out_ptr + 3 ) = rle_cnt - rle_sub;
+	out_ptr += 4;
+	const uint32_t bytesRLE = out_ptr - out_rle;
+
+	// compress directly into the output buffer
+	const int offset = out.size();
+	lzo_uint bytesLZO = bytesRLE + bytesRLE / 16 + 67;
+	out.resize( offset + sizeof( hdr ) + bytesLZO );
+
+	lzo1x_1_compress( (const unsigned char *) out_rle, (lzo_uint) bytesRLE,
+				(unsigned char *) out.data() + offset + sizeof( hdr ),
+				&bytesLZO, buffers->lzoWorkMem );
+
+	hdr.bytesRLE = Swap32IfLE( bytesRLE );
+	hdr.bytesLZO = Swap32IfLE( bytesLZO );
+	memcpy( out.data() + offset, &hdr, sizeof( hdr ) );
+
+	out.resize( offset + sizeof( hdr ) + bytesLZO );
+}
+
+
+
+void RfbLZORLE::expandRuns( const uint8_t *rleData, uint32_t bytesRLE,
+							bool delta, const QRect &rect,
+							uint32_t *frameBuffer, int width, int height )
+{
+	const int rx = rect.x();
+	const int rw = rect.width();
+	int ry = rect.y();
+
+	QRgb *dst = frameBuffer + width*ry + rx;
 	int dx = 0;
-	bool done = FALSE;
-	const int sh = c->height;
-	for( uint32_t i = 0; i < hdr.bytesRLE && done == false; i+=4 )
+	bool done = false;
+	for( uint32_t i = 0; i < bytesRLE && done == false; i+=4 )
 	{
-		const QRgb val = Swap32IfBE( *( (QRgb*)( rle_data + i ) ) ) & 0xffffff;
-		const uint8_t rleCount = rle_data[i+3];
-		for( uint16_t j = 0; j <= rleCount; ++j )
+		const QRgb val = Swap32IfBE( *( (QRgb*)( rleData + i ) ) ) & 0xffffff;
+		int remaining = rleData[i+3] + 1;
+		while( remaining > 0 )
 		{
-			*dst = val;
-			if( ++dx >= rw )
+			// expand run up to the end of current line at once
+			const int n = qMin( remaining, rw - dx );
+			if( delta == false )
+			{
+				RfbLZORLEKernels::fillPixels( dst, n, val );
+			}
+			else if( val != 0 )
+			{
+				// unchanged pixels result in zero runs which we can skip
+				for( int k = 0; k < n; ++k )
+				{
+					dst[k] = ( dst[k] ^ val ) & 0xffffff;
+				}
+			}
+			remaining -= n;
+			dx += n;
+			if( dx >= rw )
 			{
 				dx = 0;
-				if( ry+1 < sh )
+				if( ry+1 < height )
 				{
 					++ry;
-					dst = ( (QRgb *) c->frameBuffer ) + c->width*ry + rx;
+					dst = frameBuffer + width*ry + rx;
 				}
 				else
 				{
@@ -148,20 +394,67 @@ static rfbBool handleEncodingLZORLE( rfbClient *c,
 			}
 			else
 			{
-				++dst;
+				dst += n;
 			}
 		}
 	}
 
 	if( dx != 0 )
 	{
-		qWarning( "handleEncodingLZORLE(...): dx(%d) != 0", dx );
+		qWarning( "RfbLZORLE::expandRuns(...): dx(%d) != 0", dx );
 	}
+}
 
-	delete[] lzo_data;
-	delete[] rle_data;
 
-	return true;
+
+void RfbLZORLE::encodeRect( const QImage &image, const QRect &rect,
+							bool otherEndianess, QByteArray &out )
+{
+	encodeLZORLE( image, rect, rect.topLeft(), rfbEncodingLZORLE, true,
+					otherEndianess, out );
+}
+
+
+
+void RfbLZORLE::encodeTile( const QImage &tile, const QPoint &pos,
+							bool otherEndianess, QByteArray &out )
+{
+	encodeLZORLE( tile, tile.rect(), pos, rfbEncodingLZORLE, true,
+					otherEndianess, out );
+}
+
+
+
+void RfbLZORLE::encodeDeltaTile( const QImage &tile, const QImage &reference,
+									const QPoint &pos, bool otherEndianess,
+									QByteArray &out )
+{
+	if( !__encoderBuffers.hasLocalData() )
+	{
+		__encoderBuffers.setLocalData( new LZORLEEncoderBuffers );
+	}
+	QImage &delta = __encoderBuffers.localData()->deltaImage;
+	if( delta.size() != tile.size() )
+	{
+		delta = QImage( tile.size(), QImage::Format_RGB32 );
+	}
+
+	const int w = tile.width();
+	for( int y = 0; y < tile.height(); ++y )
+	{
+		const QRgb *src = (const QRgb *) tile.scanLine( y );
+		const QRgb *ref = (const QRgb *) reference.scanLine( y );
+		QRgb *dst = (QRgb *) delta.scanLine( y );
+		for( int x = 0; x < w; ++x )
+		{
+			dst[x] = src[x] ^ ref[x];
+		}
+	}
+
+	// we can't send small delta rectangles uncompressed as raw data would
+	// be taken as pixels rather than differences
+	encodeLZORLE( delta, delta.rect(), pos, rfbEncodingLZORLEDelta, false,
+					otherEndianess, out );
 }
 
 
@@ -175,9 +468,10 @@ RfbLZORLE::RfbLZORLE()
 	if( __lzoRleProtocolExt == NULL )
 	{
 		__lzoRleProtocolExt = new rfbClientProtocolExtension;
-		__lzoRleProtocolExt->encodings = new int[2];
-		__lzoRleProtocolExt->encodings[0] = rfbEncodingLZORLE;
-		__lzoRleProtocolExt->encodings[1] = 0;
+		__lzoRleProtocolExt->encodings = new int[3];
+		__lzoRleProtocolExt->encodings[0] = rfbEncodingLZORLEDelta;
+		__lzoRleProtocolExt->encodings[1] = rfbEncodingLZORLE;
+		__lzoRleProtocolExt->encodings[2] = 0;
 		__lzoRleProtocolExt->handleEncoding = handleEncodingLZORLE;
 		__lzoRleProtocolExt->handleMessage = NULL;
 
@@ -30,7 +30,15 @@
 
 #include <stdint.h>
 
+#include <QtCore/QByteArray>
+#include <QtCore/QRect>
+#include <QtGui/QImage>
+
 #define rfbEncodingLZORLE 30
+// same as rfbEncodingLZORLE but pixels are XORed with the pixels the client
+// already has at the according position - 31 is taken by
+// rfbEncodingItalcCursor so use a number no other RFB encoding uses
+#define rfbEncodingLZORLEDelta 0x4954444c
 
 class RfbLZORLE
 {
@@ -44,6 +52,29 @@ public:
 		uint32_t bytesRLE;
 	} ;
 
+	// encodes given rectangle of image and appends the RFB rectangle header,
+	// the LZORLE header and the (compressed) pixel data to out - safe to be
+	// called from multiple threads concurrently
+	static void encodeRect( const QImage &image, const QRect &rect,
+							bool otherEndianess, QByteArray &out );
+
+	// same as encodeRect() for the whole image which is announced to be
+	// located at pos
+	static void encodeTile( const QImage &tile, const QPoint &pos,
+							bool otherEndianess, QByteArray &out );
+
+	// encodes the difference between tile and reference (i.e. the content
+	// of the same area the client already has) as rfbEncodingLZORLEDelta
+	static void encodeDeltaTile( const QImage &tile, const QImage &reference,
+									const QPoint &pos, bool otherEndianess,
+									QByteArray &out );
+
+	// expands decompressed RLE data of given rectangle into a 32 bit
+	// framebuffer of given size - pixels of delta rectangles are XORed
+	static void expandRuns( const uint8_t *rleData, uint32_t bytesRLE,
+							bool delta, const QRect &rect,
+							uint32_t *frameBuffer, int width, int height );
+
 } ;
 
 #endif
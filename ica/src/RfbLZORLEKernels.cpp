@@ -0,0 +1,223 @@
+/*
+ * RfbLZORLEKernels.cpp - vectorized pixel kernels for LZORLE encoding
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <italcconfig.h>
+
+#include "RfbLZORLEKernels.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && ( defined(ITALC_HOST_X86) || defined(ITALC_HOST_X86_64) )
+#define ITALC_HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+static int matchingPixelsScalar( const uint32_t *data, int count, uint32_t value )
+{
+	int i = 0;
+	while( i < count && data[i] == value )
+	{
+		++i;
+	}
+	return i;
+}
+
+
+
+static void fillPixelsScalar( uint32_t *dst, int count, uint32_t value )
+{
+	for( int i = 0; i < count; ++i )
+	{
+		dst[i] = value;
+	}
+}
+
+
+
+#ifdef ITALC_HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static int matchingPixelsSSE2( const uint32_t *data, int count, uint32_t value )
+{
+	const __m128i v = _mm_set1_epi32( value );
+
+	int i = 0;
+	for( ; i + 4 <= count; i += 4 )
+	{
+		const __m128i d = _mm_loadu_si128( (const __m128i *)( data + i ) );
+		const int mask = _mm_movemask_ps(
+							_mm_castsi128_ps( _mm_cmpeq_epi32( d, v ) ) );
+		if( mask != 0xf )
+		{
+			return i + __builtin_ctz( ~mask );
+		}
+	}
+
+	return i + matchingPixelsScalar( data + i, count - i, value );
+}
+
+
+
+__attribute__((target("sse2")))
+static void fillPixelsSSE2( uint32_t *dst, int count, uint32_t value )
+{
+	const __m128i v = _mm_set1_epi32( value );
+
+	int i = 0;
+	for( ; i + 4 <= count; i += 4 )
+	{
+		_mm_storeu_si128( (__m128i *)( dst + i ), v );
+	}
+
+	fillPixelsScalar( dst + i, count - i, value );
+}
+
+
+
+__attribute__((target("avx2")))
+static int matchingPixelsAVX2( const uint32_t *data, int count, uint32_t value )
+{
+	const __m256i v = _mm256_set1_epi32( value );
+
+	int i = 0;
+	for( ; i + 8 <= count; i += 8 )
+	{
+		const __m256i d = _mm256_loadu_si256( (const __m256i *)( data + i ) );
+		const int mask = _mm256_movemask_ps(
+							_mm256_castsi256_ps( _mm256_cmpeq_epi32( d, v ) ) );
+		if( mask != 0xff )
+		{
+			return i + __builtin_ctz( ~mask );
+		}
+	}
+
+	// do not call SSE2 version for the tail as switching between VEX and
+	// legacy SSE encoding is expensive
+	return i + matchingPixelsScalar( data + i, count - i, value );
+}
+
+
+
+__attribute__((target("avx2")))
+static void fillPixelsAVX2( uint32_t *dst, int count, uint32_t value )
+{
+	const __m256i v = _mm256_set1_epi32( value );
+
+	int i = 0;
+	for( ; i + 8 <= count; i += 8 )
+	{
+		_mm256_storeu_si256( (__m256i *)( dst + i ), v );
+	}
+
+	fillPixelsScalar( dst + i, count - i, value );
+}
+
+#endif
+
+
+
+struct KernelSet
+{
+	int ( * matchingPixels )( const uint32_t *, int, uint32_t );
+	void ( * fillPixels )( uint32_t *, int, uint32_t );
+	const char *name;
+} ;
+
+
+// all implementations supported by the CPU we're running on, best one first
+static int supportedKernels( KernelSet *kernels )
+{
+	int count = 0;
+#ifdef ITALC_HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) )
+	{
+		const KernelSet k = { matchingPixelsAVX2, fillPixelsAVX2, "AVX2" } ;
+		kernels[count++] = k;
+	}
+	if( __builtin_cpu_supports( "sse2" ) )
+	{
+		const KernelSet k = { matchingPixelsSSE2, fillPixelsSSE2, "SSE2" } ;
+		kernels[count++] = k;
+	}
+#endif
+	const KernelSet k = { matchingPixelsScalar, fillPixelsScalar, "scalar" } ;
+	kernels[count++] = k;
+	return count;
+}
+
+
+static KernelSet selectKernels()
+{
+	KernelSet kernels[3];
+	supportedKernels( kernels );
+	return kernels[0];
+}
+
+
+static KernelSet __kernels = selectKernels();
+
+
+
+namespace RfbLZORLEKernels
+{
+
+int matchingPixelsVectorized( const uint32_t *data, int count, uint32_t value )
+{
+	return __kernels.matchingPixels( data, count, value );
+}
+
+
+
+void fillPixelsVectorized( uint32_t *dst, int count, uint32_t value )
+{
+	__kernels.fillPixels( dst, count, value );
+}
+
+
+
+const char *implementation()
+{
+	return __kernels.name;
+}
+
+
+
+bool selectImplementation( const char *name )
+{
+	KernelSet kernels[3];
+	const int count = supportedKernels( kernels );
+	for( int i = 0; i < count; ++i )
+	{
+		if( strcmp( kernels[i].name, name ) == 0 )
+		{
+			__kernels = kernels[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+}
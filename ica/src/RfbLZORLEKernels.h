@@ -0,0 +1,85 @@
+/*
+ * RfbLZORLEKernels.h - vectorized pixel kernels for LZORLE encoding
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef RFB_LZO_RLE_KERNELS_H
+#define RFB_LZO_RLE_KERNELS_H
+
+#include <stdint.h>
+
+// the best implementation for the CPU we're running on (AVX2, SSE2 or plain
+// C++) is selected once at startup
+namespace RfbLZORLEKernels
+{
+	// most runs in typical desktop content are very short so the first
+	// pixels are handled inline without bothering vector units
+	enum {
+		InlinePixels = 8
+	} ;
+
+	int matchingPixelsVectorized( const uint32_t *data, int count,
+															uint32_t value );
+	void fillPixelsVectorized( uint32_t *dst, int count, uint32_t value );
+
+	// returns number of leading pixels in data which equal value (at most
+	// count) - used for detecting runs while RLE encoding
+	inline int matchingPixels( const uint32_t *data, int count,
+															uint32_t value )
+	{
+		int i = 0;
+		while( i < count && data[i] == value )
+		{
+			if( ++i == InlinePixels && count > InlinePixels )
+			{
+				return i + matchingPixelsVectorized( data + i, count - i,
+																	value );
+			}
+		}
+		return i;
+	}
+
+	// sets count pixels at dst to value - used for expanding runs while
+	// RLE decoding
+	inline void fillPixels( uint32_t *dst, int count, uint32_t value )
+	{
+		if( count > InlinePixels )
+		{
+			fillPixelsVectorized( dst, count, value );
+			return;
+		}
+		for( int i = 0; i < count; ++i )
+		{
+			dst[i] = value;
+		}
+	}
+
+	// name of selected implementation for debugging purposes
+	const char *implementation();
+
+	// overrides automatic selection with implementation of given name
+	// ("scalar", "SSE2" or "AVX2") for benchmarking and comparing them -
+	// returns false if it is not supported by the CPU we're running on
+	bool selectImplementation( const char *name );
+}
+
+#endif
@@ -0,0 +1,666 @@
+/*
+ * SharedFramebuffer.cpp - exporting framebuffer of ICA to local processes
+ *                         through shared memory
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <italcconfig.h>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QVector>
+
+#include "SharedFramebuffer.h"
+
+#include "rfb/rfb.h"
+
+#ifdef ITALC_BUILD_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+static_assert( sizeof( SharedFramebuffer::Header ) <=
+					SharedFramebuffer::PixelOffset,
+				"header of shared framebuffer overlaps pixel data" );
+
+
+namespace SharedFramebuffer
+{
+
+QString segmentName( qint64 pid )
+{
+	if( pid < 0 )
+	{
+		pid = QCoreApplication::applicationPid();
+	}
+
+	return QString( "/italc-framebuffer-%1" ).arg( pid );
+}
+
+}
+
+
+
+#ifdef ITALC_BUILD_LINUX
+
+// readers are notified through a datagram socket bound in a directory named
+// like the segment which only the user running ICA may access so nobody else
+// can receive or fake notifications
+static QByteArray notificationDirectory( const QByteArray &name )
+{
+	return QFile::encodeName( QDir::tempPath() ) + name;
+}
+
+
+
+static QByteArray notificationPath( const QByteArray &name )
+{
+	return notificationDirectory( name ) + "/notify";
+}
+
+
+
+static bool isPrivateDirectory( const QByteArray &path )
+{
+	struct stat s;
+	return lstat( path.constData(), &s ) == 0 && S_ISDIR( s.st_mode ) &&
+			s.st_uid == geteuid() && ( s.st_mode & 077 ) == 0;
+}
+
+
+
+// returns 0 if path does not fit into a socket address
+static socklen_t notificationAddress( const QByteArray &path,
+										struct sockaddr_un *addr )
+{
+	memset( addr, 0, sizeof( *addr ) );
+	addr->sun_family = AF_UNIX;
+
+	if( path.size() >= (int) sizeof( addr->sun_path ) )
+	{
+		return 0;
+	}
+	memcpy( addr->sun_path, path.constData(), path.size() );
+
+	return offsetof( struct sockaddr_un, sun_path ) + path.size() + 1;
+}
+
+
+
+struct PixelMapping
+{
+	void *data;
+	size_t size;
+} ;
+
+
+static void unmapPixels( void *info )
+{
+	PixelMapping *mapping = static_cast<PixelMapping *>( info );
+	munmap( mapping->data, mapping->size );
+	delete mapping;
+}
+
+#endif
+
+
+
+
+SharedFramebufferWriter::SharedFramebufferWriter( const QString &name ) :
+	m_mutex(),
+	m_name( name.toUtf8() ),
+	m_fd( -1 ),
+	m_notifySocket( -1 ),
+	m_header( NULL ),
+	m_pixels( NULL ),
+	m_pixelsSize( 0 ),
+	m_readerAttached( false ),
+	m_formatWarningShown( false )
+{
+#ifdef ITALC_BUILD_LINUX
+	// a directory left over by a crashed instance with the same PID is fine
+	// as long as nobody else has access to it
+	const QByteArray dir = notificationDirectory( m_name );
+	if( ( mkdir( dir.constData(), 0700 ) < 0 && errno != EEXIST ) ||
+			isPrivateDirectory( dir ) == false )
+	{
+		qWarning( "SharedFramebufferWriter: could not create private "
+					"directory %s", dir.constData() );
+		return;
+	}
+
+	m_fd = shm_open( m_name.constData(), O_RDWR | O_CREAT | O_TRUNC, 0600 );
+	if( m_fd < 0 )
+	{
+		qWarning( "SharedFramebufferWriter: could not create segment %s: %s",
+					m_name.constData(), strerror( errno ) );
+		return;
+	}
+
+	void *header = MAP_FAILED;
+	if( ftruncate( m_fd, SharedFramebuffer::PixelOffset ) == 0 )
+	{
+		header = mmap( NULL, SharedFramebuffer::PixelOffset,
+						PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0 );
+	}
+
+	if( header == MAP_FAILED )
+	{
+		qWarning( "SharedFramebufferWriter: could not map segment %s: %s",
+					m_name.constData(), strerror( errno ) );
+		unlink();
+		return;
+	}
+
+	// all other fields are zero-initialized by ftruncate()
+	m_header = static_cast<SharedFramebuffer::Header *>( header );
+	m_header->magic = SharedFramebuffer::Magic;
+
+	m_notifySocket = socket( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+#endif
+}
+
+
+
+
+SharedFramebufferWriter::~SharedFramebufferWriter()
+{
+	unlink();
+
+#ifdef ITALC_BUILD_LINUX
+	if( m_pixels )
+	{
+		munmap( m_pixels, m_pixelsSize );
+	}
+	if( m_header )
+	{
+		munmap( m_header, SharedFramebuffer::PixelOffset );
+	}
+	if( m_notifySocket >= 0 )
+	{
+		::close( m_notifySocket );
+	}
+	if( m_fd >= 0 )
+	{
+		::close( m_fd );
+	}
+#endif
+}
+
+
+
+
+void SharedFramebufferWriter::unlink()
+{
+#ifdef ITALC_BUILD_LINUX
+	shm_unlink( m_name.constData() );
+
+	// socket of a reader still attached is removed as well
+	::unlink( notificationPath( m_name ).constData() );
+	rmdir( notificationDirectory( m_name ).constData() );
+#endif
+}
+
+
+
+
+void SharedFramebufferWriter::update( _rfbScreenInfo *screen, sraRegion *region )
+{
+	QMutexLocker lock( &m_mutex );
+
+	if( m_header == NULL )
+	{
+		return;
+	}
+
+	// pixels are exported in the layout of QImage::Format_RGB32 so the
+	// reader can wrap them without any conversion
+	const rfbPixelFormat &f = screen->serverFormat;
+	if( f.bitsPerPixel != 32 || f.trueColour == false ||
+			f.redMax != 255 || f.greenMax != 255 || f.blueMax != 255 ||
+			f.redShift != 16 || f.greenShift != 8 || f.blueShift != 0 ||
+			( f.bigEndian != 0 ) != ( QSysInfo::ByteOrder == QSysInfo::BigEndian ) )
+	{
+		if( m_formatWarningShown == false )
+		{
+			qWarning( "SharedFramebufferWriter: unsupported pixel format, "
+						"not exporting framebuffer" );
+			m_formatWarningShown = true;
+		}
+		return;
+	}
+
+	// geometry is kept up to date in any case so readers can attach at
+	// any time
+	const bool resized = screen->width != m_header->width ||
+							screen->height != m_header->height;
+	if( resized && resize( screen->width, screen->height ) == false )
+	{
+		return;
+	}
+
+	// copying pixels is only worth it while a demo server is reading them -
+	// a reader attaching later gets the complete framebuffer with the next
+	// update
+	if( m_header->readerAttached.loadAcquire() == 0 )
+	{
+		m_readerAttached = false;
+		return;
+	}
+
+	if( resized || m_readerAttached == false )
+	{
+		m_readerAttached = true;
+		copyRect( screen, 0, 0, screen->width, screen->height );
+	}
+	else
+	{
+		sraRectangleIterator *it = sraRgnGetIterator( region );
+		sraRect r;
+		while( sraRgnIteratorNext( it, &r ) )
+		{
+			const int x1 = qMax( r.x1, 0 );
+			const int y1 = qMax( r.y1, 0 );
+			const int x2 = qMin( r.x2, screen->width );
+			const int y2 = qMin( r.y2, screen->height );
+			if( x1 < x2 && y1 < y2 )
+			{
+				copyRect( screen, x1, y1, x2 - x1, y2 - y1 );
+			}
+		}
+		sraRgnReleaseIterator( it );
+	}
+
+	notify();
+}
+
+
+
+
+bool SharedFramebufferWriter::resize( int width, int height )
+{
+#ifdef ITALC_BUILD_LINUX
+	const qint64 size = (qint64) width * height * sizeof( uint32_t );
+
+	// the segment never shrinks as readers still might access pixels
+	// through mappings of the old size
+	if( size > m_pixelsSize )
+	{
+		if( m_pixels )
+		{
+			munmap( m_pixels, m_pixelsSize );
+			m_pixels = NULL;
+			m_pixelsSize = 0;
+		}
+
+		void *pixels = MAP_FAILED;
+		if( ftruncate( m_fd, SharedFramebuffer::PixelOffset + size ) == 0 )
+		{
+			pixels = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+							m_fd, SharedFramebuffer::PixelOffset );
+		}
+
+		if( pixels == MAP_FAILED )
+		{
+			qWarning( "SharedFramebufferWriter: could not resize segment: %s",
+						strerror( errno ) );
+			return false;
+		}
+
+		m_pixels = static_cast<uchar *>( pixels );
+		m_pixelsSize = size;
+	}
+
+	// geometry is odd while fields are being changed
+	m_header->geometry.fetchAndAddOrdered( 1 );
+	m_header->width = width;
+	m_header->height = height;
+	m_header->bytesPerLine = width * sizeof( uint32_t );
+	m_header->geometry.fetchAndAddOrdered( 1 );
+
+	return true;
+#else
+	Q_UNUSED(width)
+	Q_UNUSED(height)
+	return false;
+#endif
+}
+
+
+
+
+void SharedFramebufferWriter::copyRect( const _rfbScreenInfo *screen,
+										int x, int y, int w, int h )
+{
+	const int bytesPerLine = m_header->bytesPerLine;
+
+	for( int ry = y; ry < y+h; ++ry )
+	{
+		const uint32_t *src = (const uint32_t *)
+			( screen->frameBuffer + ry * screen->paddedWidthInBytes ) + x;
+		uint32_t *dst = (uint32_t *) ( m_pixels + ry * bytesPerLine ) + x;
+
+		// perform the same color-reduction ItalcVncConnection does for
+		// DemoServerQuality for better compression-results
+		for( int rx = 0; rx < w; ++rx )
+		{
+			dst[rx] = src[rx] & 0xfcfcfc;
+		}
+	}
+
+	// only we modify damageCount so no need for atomic increment
+	const quint32 n = m_header->damageCount.load();
+	const SharedFramebuffer::DamageRect r = { x, y, w, h } ;
+	m_header->damage[n % SharedFramebuffer::MaxDamageRects] = r;
+	m_header->damageCount.storeRelease( n + 1 );
+}
+
+
+
+
+void SharedFramebufferWriter::notify()
+{
+#ifdef ITALC_BUILD_LINUX
+	if( m_notifySocket < 0 ||
+			m_header->notifyPending.fetchAndStoreOrdered( 1 ) != 0 )
+	{
+		// reader has not processed previous notification yet and will
+		// see our damage as well
+		return;
+	}
+
+	struct sockaddr_un addr;
+	const socklen_t addrLen =
+			notificationAddress( notificationPath( m_name ), &addr );
+
+	const char c = 0;
+	if( sendto( m_notifySocket, &c, sizeof( c ), MSG_DONTWAIT,
+				(struct sockaddr *) &addr, addrLen ) < 0 && errno != EAGAIN )
+	{
+		// no reader attached at the moment
+		m_header->notifyPending.storeRelease( 0 );
+	}
+#endif
+}
+
+
+
+
+SharedFramebufferReader::SharedFramebufferReader( QObject *parent ) :
+	QObject( parent ),
+	m_fd( -1 ),
+	m_notifySocket( -1 ),
+	m_notifyPath(),
+	m_notifier( NULL ),
+	m_header( NULL ),
+	m_geometry( 0 ),
+	m_damageCount( 0 ),
+	m_imgLock(),
+	m_image()
+{
+}
+
+
+
+
+SharedFramebufferReader::~SharedFramebufferReader()
+{
+	close();
+}
+
+
+
+
+bool SharedFramebufferReader::open( const QString &name )
+{
+	close();
+
+#ifdef ITALC_BUILD_LINUX
+	const QByteArray n = name.toUtf8();
+
+	m_fd = shm_open( n.constData(), O_RDWR, 0 );
+	if( m_fd < 0 )
+	{
+		return false;
+	}
+
+	void *header = mmap( NULL, SharedFramebuffer::PixelOffset,
+							PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0 );
+	if( header == MAP_FAILED )
+	{
+		close();
+		return false;
+	}
+
+	m_header = static_cast<SharedFramebuffer::Header *>( header );
+	if( m_header->magic != SharedFramebuffer::Magic )
+	{
+		close();
+		return false;
+	}
+
+	// do not bind our socket in a directory someone else prepared
+	if( isPrivateDirectory( notificationDirectory( n ) ) == false )
+	{
+		qWarning( "SharedFramebufferReader: notification directory of %s "
+					"is not private", n.constData() );
+		close();
+		return false;
+	}
+
+	struct sockaddr_un addr;
+	const QByteArray path = notificationPath( n );
+	const socklen_t addrLen = notificationAddress( path, &addr );
+
+	// remove socket of a previous reader which did not clean up
+	::unlink( path.constData() );
+
+	m_notifySocket = socket( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+	if( m_notifySocket < 0 || addrLen == 0 ||
+			bind( m_notifySocket, (struct sockaddr *) &addr, addrLen ) < 0 )
+	{
+		qWarning( "SharedFramebufferReader: could not bind notification "
+					"socket: %s", strerror( errno ) );
+		close();
+		return false;
+	}
+	m_notifyPath = path;
+
+	// segment already contains the complete framebuffer so everything
+	// before now is not of interest
+	m_damageCount = m_header->damageCount.loadAcquire();
+	m_header->notifyPending.storeRelease( 0 );
+	m_header->readerAttached.storeRelease( 1 );
+
+	if( mapPixels() == false )
+	{
+		close();
+		return false;
+	}
+
+	m_notifier = new QSocketNotifier( m_notifySocket, QSocketNotifier::Read, this );
+	connect( m_notifier, SIGNAL( activated( int ) ), this, SLOT( readDamage() ) );
+
+	return true;
+#else
+	Q_UNUSED(name)
+	return false;
+#endif
+}
+
+
+
+
+void SharedFramebufferReader::close()
+{
+	delete m_notifier;
+	m_notifier = NULL;
+
+#ifdef ITALC_BUILD_LINUX
+	if( m_notifySocket >= 0 )
+	{
+		::close( m_notifySocket );
+		m_notifySocket = -1;
+	}
+	if( m_notifyPath.isEmpty() == false )
+	{
+		::unlink( m_notifyPath.constData() );
+		m_notifyPath.clear();
+		m_header->readerAttached.storeRelease( 0 );
+	}
+	if( m_header )
+	{
+		munmap( m_header, SharedFramebuffer::PixelOffset );
+		m_header = NULL;
+	}
+	if( m_fd >= 0 )
+	{
+		::close( m_fd );
+		m_fd = -1;
+	}
+#endif
+}
+
+
+
+
+bool SharedFramebufferReader::mapPixels()
+{
+#ifdef ITALC_BUILD_LINUX
+	// geometry might be changed by the writer while we're reading it
+	quint32 geometry;
+	int width, height, bytesPerLine;
+	do
+	{
+		geometry = m_header->geometry.loadAcquire();
+		width = m_header->width;
+		height = m_header->height;
+		bytesPerLine = m_header->bytesPerLine;
+	} while( ( geometry & 1 ) ||
+				m_header->geometry.loadAcquire() != geometry );
+
+	if( width <= 0 || height <= 0 || bytesPerLine < width * 4 )
+	{
+		return false;
+	}
+
+	const size_t size = (size_t) bytesPerLine * height;
+	void *pixels = mmap( NULL, size, PROT_READ, MAP_SHARED, m_fd,
+							SharedFramebuffer::PixelOffset );
+	if( pixels == MAP_FAILED )
+	{
+		return false;
+	}
+
+	// the image just wraps the mapping which is released after the last
+	// copy of the image (e.g. in a DemoServerEncoder thread) is destroyed
+	PixelMapping *mapping = new PixelMapping;
+	mapping->data = pixels;
+	mapping->size = size;
+
+	m_imgLock.lockForWrite();
+	m_image = QImage( (const uchar *) pixels, width, height, bytesPerLine,
+						QImage::Format_RGB32, unmapPixels, mapping );
+	m_imgLock.unlock();
+
+	m_geometry = geometry;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+
+
+void SharedFramebufferReader::readDamage()
+{
+#ifdef ITALC_BUILD_LINUX
+	char buf[64];
+	while( recv( m_notifySocket, buf, sizeof( buf ), MSG_DONTWAIT ) >= 0 )
+	{
+	}
+
+	// reset before looking at damage so we're notified about everything
+	// the writer adds from now on
+	m_header->notifyPending.storeRelease( 0 );
+
+	if( m_header->geometry.loadAcquire() != m_geometry )
+	{
+		m_damageCount = m_header->damageCount.loadAcquire();
+		if( mapPixels() )
+		{
+			const QSize s = framebufferSize();
+			emit framebufferSizeChanged( s.width(), s.height() );
+			emit imageUpdated( 0, 0, s.width(), s.height() );
+		}
+		return;
+	}
+
+	const quint32 count = m_header->damageCount.loadAcquire();
+
+	QVector<QRect> rects;
+	bool overflow = count - m_damageCount > SharedFramebuffer::MaxDamageRects;
+	if( overflow == false )
+	{
+		for( quint32 i = m_damageCount; i != count; ++i )
+		{
+			const SharedFramebuffer::DamageRect &r =
+					m_header->damage[i % SharedFramebuffer::MaxDamageRects];
+			rects += QRect( r.x, r.y, r.w, r.h );
+		}
+
+		// entries might have been overwritten while reading them
+		overflow = m_header->damageCount.loadAcquire() - m_damageCount >
+										SharedFramebuffer::MaxDamageRects;
+	}
+
+	m_damageCount = count;
+
+	const QRect bounds( QPoint( 0, 0 ), framebufferSize() );
+	if( overflow )
+	{
+		rects.clear();
+		rects += bounds;
+	}
+
+	for( const QRect &rect : rects )
+	{
+		const QRect r = rect.intersected( bounds );
+		if( r.isEmpty() == false )
+		{
+			emit imageUpdated( r.x(), r.y(), r.width(), r.height() );
+		}
+	}
+#endif
+}
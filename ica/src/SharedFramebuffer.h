@@ -0,0 +1,181 @@
+/*
+ * SharedFramebuffer.h - exporting framebuffer of ICA to local processes
+ *                       through shared memory
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef SHARED_FRAMEBUFFER_H
+#define SHARED_FRAMEBUFFER_H
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QReadWriteLock>
+#include <QtGui/QImage>
+
+class QSocketNotifier;
+
+struct _rfbScreenInfo;
+struct sraRegion;
+
+
+// the ICA process exports the framebuffer of its VNC server into a shared
+// memory segment so the demo server slave can access the pixels directly
+// instead of decoding them from a local VNC connection - currently only
+// supported on Linux
+namespace SharedFramebuffer
+{
+	enum {
+		Magic = 0x42465349,			// "ISFB"
+		MaxDamageRects = 1024,
+		PixelOffset = 64*1024		// page aligned offset of pixel data
+	} ;
+
+	struct DamageRect
+	{
+		qint32 x;
+		qint32 y;
+		qint32 w;
+		qint32 h;
+	} ;
+
+	// layout of the beginning of the segment - the pixels (RGB32) follow
+	// at PixelOffset
+	struct Header
+	{
+		quint32 magic;
+		// incremented before and after width, height or bytesPerLine
+		// change, i.e. odd while they're inconsistent
+		QBasicAtomicInteger<quint32> geometry;
+		qint32 width;
+		qint32 height;
+		qint32 bytesPerLine;
+		// set by writer when sending a notification and reset by reader
+		// before processing damage so notifications are coalesced
+		QBasicAtomicInteger<quint32> notifyPending;
+		// set by reader while attached - writer does not copy any pixels
+		// otherwise
+		QBasicAtomicInteger<quint32> readerAttached;
+		// ring buffer of damaged rects, damageCount is incremented after
+		// the pixels of a rect have been copied
+		QBasicAtomicInteger<quint32> damageCount;
+		DamageRect damage[MaxDamageRects];
+	} ;
+
+	// name of the segment exported by the ICA process with given PID
+	QString segmentName( qint64 pid = -1 );
+}
+
+
+
+// used by ICA for copying modified regions of VNC server's framebuffer into
+// the shared segment - update() is called in context of VNC server thread
+class SharedFramebufferWriter
+{
+public:
+	SharedFramebufferWriter( const QString &name );
+	~SharedFramebufferWriter();
+
+	void update( _rfbScreenInfo *screen, sraRegion *region );
+
+	// removes the segment's name so no new readers can attach
+	void unlink();
+
+
+private:
+	bool resize( int width, int height );
+	void copyRect( const _rfbScreenInfo *screen, int x, int y, int w, int h );
+	void notify();
+
+	QMutex m_mutex;
+	QByteArray m_name;
+	int m_fd;
+	int m_notifySocket;
+	SharedFramebuffer::Header *m_header;
+	uchar *m_pixels;
+	qint64 m_pixelsSize;
+	bool m_readerAttached;
+	bool m_formatWarningShown;
+
+} ;
+
+
+
+// used by demo server slave for accessing the framebuffer - wraps the shared
+// pixels without copying them and provides the same interface as
+// ItalcVncConnection does
+class SharedFramebufferReader : public QObject
+{
+	Q_OBJECT
+public:
+	SharedFramebufferReader( QObject *parent = NULL );
+	virtual ~SharedFramebufferReader();
+
+	// returns false if the segment does not exist (e.g. on non-Linux
+	// platforms or with VNC server not exporting its framebuffer)
+	bool open( const QString &name );
+
+	bool isOpen() const
+	{
+		return m_header != NULL;
+	}
+
+	const QImage image() const
+	{
+		QReadLocker locker( &m_imgLock );
+		return m_image;
+	}
+
+	QSize framebufferSize() const
+	{
+		QReadLocker locker( &m_imgLock );
+		return m_image.size();
+	}
+
+
+signals:
+	void imageUpdated( int x, int y, int w, int h );
+	void framebufferSizeChanged( int w, int h );
+
+
+private slots:
+	void readDamage();
+
+
+private:
+	bool mapPixels();
+	void close();
+
+	int m_fd;
+	int m_notifySocket;
+	QByteArray m_notifyPath;
+	QSocketNotifier *m_notifier;
+	SharedFramebuffer::Header *m_header;
+	quint32 m_geometry;
+	quint32 m_damageCount;
+
+	mutable QReadWriteLock m_imgLock;
+	QImage m_image;
+
+} ;
+
+#endif
@@ -225,6 +225,8 @@ qint64 vsocketDispatcher( char * _buf, const qint64 _len,
 		case SocketGetPeerAddress:
 			strncpy( _buf, sock->GetPeerName(), _len );
 			return( 0 );
+		default:
+			break;
 	}
 	return( 0 );
 
@@ -112,6 +112,27 @@ rfbClientProtocolExtension* rfbClientExtensions = NULL;
 
 void rfbClientRegisterExtension(rfbClientProtocolExtension* e)
 {
+	rfbClientProtocolExtension* other;
+	int* enc;
+	int* otherEnc;
+
+	/* extensions are looked up first-match, so an encoding claimed twice
+	   would silently be handled by whichever was registered last */
+	for(other = rfbClientExtensions; other; other = other->next) {
+		if(other == e) {
+			return;
+		}
+		if(!e->encodings || !other->encodings)
+			continue;
+		for(enc = e->encodings; *enc; enc++)
+			for(otherEnc = other->encodings; *otherEnc; otherEnc++)
+				if(*enc == *otherEnc) {
+					rfbClientErr("rfbClientRegisterExtension: encoding %d "
+							"is already handled by another extension\n", *enc);
+					return;
+				}
+	}
+
 	e->next = rfbClientExtensions;
 	rfbClientExtensions = e;
 }
@@ -1991,6 +2012,9 @@ HandleRFBServerMessage(rfbClient* client)
         client->SoftCursorLockArea(client, rect.r.x, rect.r.y, rect.r.w, rect.r.h);
       }
 
+      /* copied pixels may stem from a lossy rectangle as well */
+      client->lastRectLossy = (rect.encoding == rfbEncodingCopyRect);
+
       switch (rect.encoding) {
 
       case rfbEncodingRaw: {
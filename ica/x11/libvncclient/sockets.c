@@ -86,6 +86,7 @@ rfbBool errorMessageOnReadFailure = TRUE;
 rfbBool
 ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
 {
+  int stalls = 0;
 #undef DEBUG_READ_EXACT
 #ifdef DEBUG_READ_EXACT
 	char* oout=out;
@@ -172,6 +173,11 @@ ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
 	    */
 	    WaitForMessage(client, 100000);
 	    i = 0;
+	    /* give up on servers which stop sending in the middle of a message */
+	    if (client->readTimeout > 0 && ++stalls > client->readTimeout * 10) {
+	      rfbClientErr("read timed out after %d seconds\n", client->readTimeout);
+	      return FALSE;
+	    }
 	  } else {
 	    rfbClientErr("read (%d: %s)\n",errno,strerror(errno));
 	    return FALSE;
@@ -183,6 +189,8 @@ ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
 	  return FALSE;
 	}
       }
+      if (i > 0)
+        stalls = 0;
       client->buffered += i;
     }
 
@@ -211,6 +219,11 @@ ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
 	    */
 	    WaitForMessage(client, 100000);
 	    i = 0;
+	    /* give up on servers which stop sending in the middle of a message */
+	    if (client->readTimeout > 0 && ++stalls > client->readTimeout * 10) {
+	      rfbClientErr("read timed out after %d seconds\n", client->readTimeout);
+	      return FALSE;
+	    }
 	  } else {
 	    rfbClientErr("read (%s)\n",strerror(errno));
 	    return FALSE;
@@ -222,6 +235,8 @@ ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
 	  return FALSE;
 	}
       }
+      if (i > 0)
+        stalls = 0;
       out += i;
       n -= i;
     }
@@ -143,6 +143,7 @@ HandleTightBPP (rfbClient* client, int rx, int ry, int rw, int rh)
   }
 #else
   if (comp_ctl == rfbTightJpeg) {
+    client->lastRectLossy = TRUE;
     return DecompressJpegRectBPP(client, rx, ry, rw, rh);
   }
 #endif
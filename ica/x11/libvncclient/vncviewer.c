@@ -396,6 +396,11 @@ void rfbClientCleanup(rfbClient* client) {
 
   FreeTLS(client);
 
+  if (client->ultra_buffer)
+    free(client->ultra_buffer);
+  if (client->raw_buffer)
+    free(client->raw_buffer);
+
   while (client->clientData) {
     rfbClientData* next = client->clientData->next;
     free(client->clientData);
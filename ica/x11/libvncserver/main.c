@@ -259,6 +259,8 @@ rfbDefaultLog(const char *format, ...)
 rfbLogProc rfbLog=rfbDefaultLog;
 rfbLogProc rfbErr=rfbDefaultLog;
 
+rfbFramebufferModifiedProc rfbFramebufferModified=NULL;
+
 void rfbLogPerror(const char *str)
 {
     rfbErr("%s: %s\n", str, strerror(errno));
@@ -351,6 +353,9 @@ void rfbScheduleCopyRegion(rfbScreenInfoPtr rfbScreen,sraRegionPtr copyRegion,in
    }
 
    rfbReleaseClientIterator(iterator);
+
+   if(rfbFramebufferModified)
+     rfbFramebufferModified(rfbScreen,copyRegion);
 }
 
 void rfbDoCopyRegion(rfbScreenInfoPtr screen,sraRegionPtr copyRegion,int dx,int dy)
@@ -410,6 +415,9 @@ void rfbMarkRegionAsModified(rfbScreenInfoPtr screen,sraRegionPtr modRegion)
    }
 
    rfbReleaseClientIterator(iterator);
+
+   if(rfbFramebufferModified)
+     rfbFramebufferModified(screen,modRegion);
 }
 
 void rfbScaledScreenUpdate(rfbScreenInfoPtr screen, int x1, int y1, int x2, int y2);
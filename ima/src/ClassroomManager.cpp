@@ -990,12 +990,7 @@ void ClassroomManager::changeGlobalClientMode( int _mode )
 					new_mode == Client::Mode_Overview )
 	{
 		m_globalClientMode = new_mode;
-		QVector<Client *> vc = visibleClients();
-
-		foreach( Client * cl, vc )
-		{
-			cl->changeMode( m_globalClientMode );
-		}
+		Client::changeMode( visibleClients(), m_globalClientMode );
 	}
 }
 
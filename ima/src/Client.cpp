@@ -141,31 +141,19 @@ void ClientAction::process( QVector<Client *> _clients, TargetGroup _target )
 	switch ( m_type )
 	{
 		case Overview:
-			foreach( Client * cl, _clients )
-			{
-				cl->changeMode( Client::Mode_Overview );
-			}
+			Client::changeMode( _clients, Client::Mode_Overview );
 			break;
 
 		case FullscreenDemo:
-			foreach( Client * cl, _clients )
-			{
-				cl->changeMode( Client::Mode_FullscreenDemo );
-			}
+			Client::changeMode( _clients, Client::Mode_FullscreenDemo );
 			break;
 
 		case WindowDemo:
-			foreach( Client * cl, _clients )
-			{
-				cl->changeMode( Client::Mode_WindowDemo );
-			}
+			Client::changeMode( _clients, Client::Mode_WindowDemo );
 			break;
 
 		case Locked:
-			foreach( Client * cl, _clients )
-			{
-				cl->changeMode( Client::Mode_Locked );
-			}
+			Client::changeMode( _clients, Client::Mode_Locked );
 			break;
 
 		case ViewLive:
@@ -197,10 +185,10 @@ void ClientAction::process( QVector<Client *> _clients, TargetGroup _target )
 				if( tmd.exec() == QDialog::Accepted &&
 					!msg.isEmpty() )
 				{
-					foreach( Client * cl, _clients )
-					{
-						cl->sendTextMessage( msg );
-					}
+					broadcast( _clients,
+						ItalcCore::Msg( ItalcCore::DisplayTextMessage ).
+							addArg( "title", Client::tr( "Message from teacher" ) ).
+							addArg( "text", msg ) );
 				}
 			}
 
@@ -229,10 +217,7 @@ void ClientAction::process( QVector<Client *> _clients, TargetGroup _target )
 		case LogoutUser:
 			if ( confirmLogout( _target ) )
 			{
-				foreach( Client * cl, _clients )
-				{
-					cl->logoutUser();
-				}
+				broadcast( _clients, ItalcCore::Msg( ItalcCore::LogoutUser ) );
 			}
 			break;
 
@@ -253,20 +238,15 @@ void ClientAction::process( QVector<Client *> _clients, TargetGroup _target )
 		case Reboot:
 			if ( confirmReboot( _target ) )
 			{
-				foreach( Client * cl, _clients )
-				{
-					cl->reboot();
-				}
+				broadcast( _clients, ItalcCore::Msg( ItalcCore::RestartComputer ) );
 			}
 			break;
 
 		case PowerDown:
 			if ( confirmPowerDown( _target ) )
 			{
-				foreach( Client * cl, _clients )
-				{
-					cl->powerDown();
-				}
+				broadcast( _clients,
+							ItalcCore::Msg( ItalcCore::PowerDownComputer ) );
 			}
 			break;
 
@@ -278,10 +258,8 @@ void ClientAction::process( QVector<Client *> _clients, TargetGroup _target )
 				if( cmd_input_dialog.exec() == QDialog::Accepted &&
 					!cmds.isEmpty() )
 				{
-					foreach( Client * cl, _clients )
-					{
-						cl->execCmds( cmds );
-					}
+					broadcast( _clients, ItalcCore::Msg( ItalcCore::ExecCmds ).
+												addArg( "cmds", cmds ) );
 				}
 			}
 			break;
@@ -289,10 +267,8 @@ void ClientAction::process( QVector<Client *> _clients, TargetGroup _target )
 		case RemoteScript:
 			{
 				QString script = dataExpanded( _clients );
-				foreach( Client * cl, _clients )
-				{
-					cl->execCmds( script );
-				}
+				broadcast( _clients, ItalcCore::Msg( ItalcCore::ExecCmds ).
+											addArg( "cmds", script ) );
 				break;
 			}
 
@@ -308,6 +284,22 @@ void ClientAction::process( QVector<Client *> _clients, TargetGroup _target )
 
 
 
+void ClientAction::broadcast( const QVector<Client *> &_clients,
+											const ItalcCore::Msg &_msg )
+{
+	QVector<ItalcCoreConnection *> connections;
+	foreach( Client * cl, _clients )
+	{
+		connections += cl->connection();
+	}
+
+	// results are logged by ItalcCoreBroadcast
+	ItalcCoreConnection::broadcast( connections, _msg );
+}
+
+
+
+
 QString ClientAction::dataExpanded( QVector<Client *> _clients ) const
 {
 	static QRegExp s_reITALC_HOSTS( "\\$ITALC_HOSTS\\b" );
@@ -468,7 +460,6 @@ Client::Client( const QString & _hostname,
 	m_mainWindow( mainWindow ),
 	m_connection( NULL ),
 	m_vncConn( NULL ),
-	m_framebufferUpdated( false ),
 	m_userInformationAge(),
 	m_clickPoint( -1, -1 ),
 	m_origPos( -1, -1 ),
@@ -499,13 +490,12 @@ Client::Client( const QString & _hostname,
 	m_vncConn->setFramebufferUpdateInterval(
 				m_mainWindow->getClassroomManager()->updateInterval() );
 
-	// set a flag so we only update the view if there were some updates
+	// only repaint tile if there were some updates
 	connect( m_vncConn, SIGNAL( framebufferUpdateComplete() ),
-				this, SLOT( setUpdateFlag() ) );
+				this, SLOT( updateScreen() ) );
 
 	m_connection = new ItalcCoreConnection( m_vncConn );
 
-	setAttribute( Qt::WA_OpaquePaintEvent );
 	setWindowIcon( QPixmap( ":/resources/applications-education.png" ) );
 
 /*	setWhatsThis( tr( "This is a client-window. It either displays the "
@@ -593,51 +583,100 @@ int Client::freeID( void )
 
 void Client::changeMode( const Modes _new_mode )
 {
-	if( _new_mode != m_mode )
+	changeMode( QVector<Client *>() << this, _new_mode );
+}
+
+
+
+
+void Client::changeMode( const QVector<Client *> &_clients,
+							const Modes _new_mode )
+{
+	QVector<Client *> stoppingDemo;
+	QVector<Client *> unlocking;
+	QVector<Client *> entering;
+
+	foreach( Client * cl, _clients )
 	{
-		switch( m_mode )
+		if( _new_mode == cl->m_mode )
+		{
+			// if connection was lost while sending commands such as
+			// stop-demo, there should be a way for switching back into
+			// normal mode, that's why we offer this lines
+			if( _new_mode == Mode_Overview )
+			{
+				stoppingDemo += cl;
+				unlocking += cl;
+			}
+			continue;
+		}
+
+		switch( cl->m_mode )
 		{
 			case Mode_Overview:
 			case Mode_Unknown:
 				break;
 			case Mode_FullscreenDemo:
 			case Mode_WindowDemo:
-				m_mainWindow->localICA()->demoServerUnallowHost( m_hostname );
-				m_connection->stopDemo();
+				cl->m_mainWindow->localICA()->
+								demoServerUnallowHost( cl->m_hostname );
+				stoppingDemo += cl;
 				break;
 			case Mode_Locked:
-				m_connection->unlockScreen();
+				unlocking += cl;
 				break;
 		}
-		switch( m_mode = _new_mode )
+		switch( cl->m_mode = _new_mode )
 		{
 			case Mode_Overview:
 			case Mode_Unknown:
 				break;
 			case Mode_FullscreenDemo:
 			case Mode_WindowDemo:
-				m_mainWindow->localICA()->demoServerAllowHost( m_hostname );
-				m_connection->startDemo(
-								QString(),// let client guess IP from connection
-								ItalcCore::config->demoServerPort(),
-								m_mode == Mode_FullscreenDemo );
+				cl->m_mainWindow->localICA()->
+								demoServerAllowHost( cl->m_hostname );
+				entering += cl;
 				break;
 			case Mode_Locked:
-				m_connection->lockScreen();
+				entering += cl;
 				break;
 		}
 	}
-	// if connection was lost while sending commands such as stop-demo,
-	// there should be a way for switching back into normal mode, that's
-	// why we offer this lines
-	else if( m_mode == Mode_Overview )
+
+	// commands for each connection are still sent in the order needed for
+	// switching modes as every connection processes its queue in order
+	if( !stoppingDemo.isEmpty() )
 	{
-	/*	if( conn != NULL )
-		{
-			conn->demoServerDenyClient( m_hostname );
-		}*/
-		m_connection->stopDemo();
-		m_connection->unlockScreen();
+		ClientAction::broadcast( stoppingDemo,
+									ItalcCore::Msg( ItalcCore::StopDemo ) );
+	}
+	if( !unlocking.isEmpty() )
+	{
+		ClientAction::broadcast( unlocking,
+									ItalcCore::Msg( ItalcCore::UnlockScreen ) );
+	}
+	if( entering.isEmpty() )
+	{
+		return;
+	}
+
+	switch( _new_mode )
+	{
+		case Mode_FullscreenDemo:
+		case Mode_WindowDemo:
+			ClientAction::broadcast( entering,
+				ItalcCore::Msg( ItalcCore::StartDemo ).
+					// let clients guess IP from connection
+					addArg( "host", QString() ).
+					addArg( "port", ItalcCore::config->demoServerPort() ).
+					addArg( "fullscreen", _new_mode == Mode_FullscreenDemo ) );
+			break;
+		case Mode_Locked:
+			ClientAction::broadcast( entering,
+									ItalcCore::Msg( ItalcCore::LockScreen ) );
+			break;
+		default:
+			break;
 	}
 }
 
@@ -680,7 +719,7 @@ void Client::update()
 	}
 
 	m_state = currentState();
-	QWidget::update();
+	m_mainWindow->workspace()->updateTile( this );
 }
 
 
@@ -854,7 +893,7 @@ void Client::mouseDoubleClickEvent( QMouseEvent * _me )
 
 
 
-void Client::paintEvent( QPaintEvent * _pe )
+void Client::paintTile( QPainter & p )
 {
 	static QImage * img_unknown = NULL;
 	static QImage * img_host_unreachable = NULL;
@@ -868,7 +907,7 @@ void Client::paintEvent( QPaintEvent * _pe )
 		img_demo = new QImage( ":/resources/preferences-desktop-display-orange.png" );
 
 
-	QPainter p( this );
+	p.setFont( font() );
 	p.setBrush( Qt::white );
 	p.setPen( Qt::black );
 	p.drawRect( QRect( 0, 0, width()-1, height()-1 ) );
@@ -939,8 +978,17 @@ void Client::paintEvent( QPaintEvent * _pe )
 
 	if( m_takeSnapshot )
 	{
-		Snapshot().take( m_connection->vncConnection(), m_user );
-		m_takeSnapshot = false;
+		ItalcVncConnection *vncConn = m_connection->vncConnection();
+		// wait until server sends framebuffer in full resolution again
+		if( vncConn->isConnected() == false ||
+				( vncConn->framebufferInitialized() &&
+					vncConn->framebufferSize() ==
+									vncConn->nativeFramebufferSize() ) )
+		{
+			Snapshot().take( vncConn, m_user );
+			m_takeSnapshot = false;
+			updateThumbnailSize();
+		}
 	}
 }
 
@@ -953,12 +1001,30 @@ void Client::resizeEvent( QResizeEvent * _re )
 	m_connection->vncConnection()->setScaledSize( size() -
 							CONTENT_SIZE_SUB );
 	m_connection->vncConnection()->rescaleScreen();
+	updateThumbnailSize();
 	QWidget::resizeEvent( _re );
 }
 
 
 
 
+void Client::updateThumbnailSize()
+{
+	// let server scale down framebuffer so we do not have to transfer and
+	// scale the full resolution image - except for snapshots
+	if( m_takeSnapshot )
+	{
+		m_connection->setThumbnailSize( QSize() );
+	}
+	else
+	{
+		m_connection->setThumbnailSize( size() - CONTENT_SIZE_SUB );
+	}
+}
+
+
+
+
 
 void Client::showEvent( QShowEvent * )
 {
@@ -975,16 +1041,14 @@ void Client::showEvent( QShowEvent * )
 
 void Client::reload()
 {
-	QTimer::singleShot(
-				m_mainWindow->getClassroomManager()->updateInterval(),
-				this,
-				SLOT( reload() ) );
-
 	if( !isVisible() )
 	{
-		if( m_connection->vncConnection()->isRunning() )
+		// keep connection so showing client again (e.g. when switching back
+		// to its classroom) does not require connecting again
+		if( m_connection->vncConnection()->isActive() &&
+				m_connection->vncConnection()->isPaused() == false )
 		{
-			m_connection->vncConnection()->stop();
+			m_connection->vncConnection()->pause();
 
 			update();
 		}
@@ -992,17 +1056,19 @@ void Client::reload()
 		return;
 	}
 
+	m_connection->vncConnection()->resume();
+
+	updatePriority();
+
 	switch( m_connection->state() )
 	{
 	case ItalcVncConnection::Connected:
-		if( m_framebufferUpdated )
-		{
-			m_framebufferUpdated = false;
-			update();
-		}
-
+		// servers pushing notifications tell us about changes on their own
+		// so only poll them occasionally in case a notification got lost
 		if( m_userInformationAge.isValid() == false ||
-				m_userInformationAge.elapsed() > 60*1000 )
+				m_userInformationAge.elapsed() >
+					( m_connection->receivesNotifications() ? 10 : 1 ) *
+																60*1000 )
 		{
 			m_connection->sendGetUserInformationRequest();
 
@@ -1038,9 +1104,30 @@ void Client::reload()
 
 
 
-void Client::setUpdateFlag()
+void Client::updatePriority()
 {
-	m_framebufferUpdated = true;
+	// let connection pool prefer enlarged clients and neglect clients
+	// scrolled out of view
+	ItalcVncConnection::UpdatePriorities priority =
+							ItalcVncConnection::NormalUpdatePriority;
+	if( m_origSize.isValid() )
+	{
+		priority = ItalcVncConnection::HighUpdatePriority;
+	}
+	else if( visibleRegion().isEmpty() )
+	{
+		priority = ItalcVncConnection::LowUpdatePriority;
+	}
+
+	m_vncConn->setUpdatePriority( priority );
+}
+
+
+
+
+void Client::updateScreen()
+{
+	m_mainWindow->workspace()->updateTile( this );
 }
 
 
@@ -1052,14 +1139,9 @@ void Client::clientDemo()
 	cm->changeGlobalClientMode( Mode_Overview );
 
 	QVector<Client *> vc = cm->visibleClients();
+	vc.removeAll( this );
 
-	foreach( Client * cl, vc )
-	{
-		if( cl != this )
-		{
-			cl->changeMode( Mode_FullscreenDemo );
-		}
-	}
+	changeMode( vc, Mode_FullscreenDemo );
 
 	//m_mainWindow->checkModeButton( Client::Mode_FullscreenDemo );
 
@@ -1117,6 +1199,8 @@ void Client::logoutUser()
 void Client::snapshot()
 {
 	m_takeSnapshot = true;
+	updateThumbnailSize();
+	update();
 }
 
 
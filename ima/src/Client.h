@@ -35,12 +35,17 @@
 #include <QtGui/QImage>
 #include <QMenu>
 
+class QPainter;
 class classRoom;
 class classRoomItem;
 class Client;
 class MainWindow;
 class ItalcCoreConnection;
 class ItalcVncConnection;
+namespace ItalcCore
+{
+	class Msg;
+}
 
 typedef void( Client:: * execCmd )( const QString & );
 
@@ -95,6 +100,10 @@ public:
 	static void process( QAction * _action,
 			QVector<Client *> _clients, TargetGroup _target = Default );
 
+	// sends message to all clients at once instead of one by one
+	static void broadcast( const QVector<Client *> &_clients,
+							const ItalcCore::Msg &_msg );
+
 	inline bool flags( int _mask = -1 )
 	{
 		return ( m_flags & _mask );
@@ -188,6 +197,9 @@ public:
 
 	// action-handlers
 	void changeMode( const Modes _new_mode );
+	// switches all given clients at once by broadcasting the commands
+	static void changeMode( const QVector<Client *> &_clients,
+							const Modes _new_mode );
 	void viewLive( void );
 	void remoteControl( void );
 	void clientDemo( void );
@@ -227,6 +239,11 @@ public:
 		return( m_type );
 	}
 
+	inline ItalcCoreConnection * connection( void ) const
+	{
+		return( m_connection );
+	}
+
 	inline const QString & user( void ) const
 	{
 		return( m_user );
@@ -261,6 +278,12 @@ public:
 
 	virtual void update();
 
+	// called by workspace with painter translated to our position
+	void paintTile( QPainter & p );
+
+	// called by workspace for all clients at once every update interval
+	void reload( void );
+
 
 	void zoom( void );
 	void zoomBack( void );
@@ -275,8 +298,7 @@ public slots:
 
 private slots:
 	void enlarge( void );
-	void reload( void );
-	void setUpdateFlag();
+	void updateScreen();
 
 
 private:
@@ -287,18 +309,18 @@ private:
 	virtual void mouseMoveEvent( QMouseEvent * _me );
 	virtual void mouseReleaseEvent( QMouseEvent * _me );
 	virtual void mouseDoubleClickEvent( QMouseEvent * _me );
-	virtual void paintEvent( QPaintEvent * _pe );
 	virtual void resizeEvent( QResizeEvent * _re );
 	virtual void showEvent( QShowEvent * _se );
 
 
 	States currentState( void ) const;
+	void updateThumbnailSize();
+	void updatePriority();
 
 
 	MainWindow * m_mainWindow;
 	ItalcCoreConnection *m_connection;
 	ItalcVncConnection *m_vncConn;
-	bool m_framebufferUpdated;
 	QTime m_userInformationAge;
 	QPoint m_clickPoint;
 	QPoint m_origPos;
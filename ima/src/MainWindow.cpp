@@ -34,6 +34,8 @@
 #include <QMenu>
 #include <QMenuBar>
 #include <QMessageBox>
+#include <QPainter>
+#include <QPaintEvent>
 #include <QScrollArea>
 #include <QSplashScreen>
 #include <QToolBar>
@@ -95,7 +97,7 @@ MainWindow::MainWindow( int _rctrl_screen ) :
 
 	// configure scroll area
 	m_scrollArea->setBackgroundRole( QPalette::Dark );
-	m_workspace = new clientWorkspace( m_scrollArea );
+	m_workspace = new clientWorkspace( m_scrollArea, this );
 
 
 	// now create all sidebar-workspaces
@@ -591,11 +593,29 @@ void MainWindowUpdateThread::run( void )
 
 
 
-clientWorkspace::clientWorkspace( QScrollArea * _parent ) :
+clientWorkspace::clientWorkspace( QScrollArea * _parent,
+									MainWindow * _main_window ) :
 	QWidget( _parent ),
-	m_contextMenu( NULL )
+	m_mainWindow( _main_window ),
+	m_contextMenu( NULL ),
+	m_dirtyTiles(),
+	m_frameTimer( this ),
+	m_reloadTimer( this )
 {
 	setStyleSheet( "background-image: url(:/resources/toolbar-background.png);" );
+	// style sheet backgrounds are only drawn automatically for plain QWidgets
+	setAttribute( Qt::WA_StyledBackground );
+
+	m_frameTimer.setSingleShot( true );
+	m_frameTimer.setInterval( FrameInterval );
+	connect( &m_frameTimer, SIGNAL( timeout() ),
+				this, SLOT( paintDirtyTiles() ) );
+
+	// classroom manager with update interval does not exist yet
+	m_reloadTimer.setSingleShot( true );
+	connect( &m_reloadTimer, SIGNAL( timeout() ),
+				this, SLOT( reloadTiles() ) );
+	m_reloadTimer.start( 0 );
 
 	_parent->setWidget( this );
 	_parent->setWidgetResizable( TRUE );
@@ -615,6 +635,60 @@ QSize clientWorkspace::sizeHint( void ) const
 
 
 
+void clientWorkspace::updateTile( Client * _client )
+{
+	m_dirtyTiles.insert( _client );
+
+	if( !m_frameTimer.isActive() )
+	{
+		m_frameTimer.start();
+	}
+}
+
+
+
+
+void clientWorkspace::paintDirtyTiles()
+{
+	// only look at our children so we never touch deleted clients
+	QRegion dirty;
+	foreach( QObject * o, children() )
+	{
+		Client * c = qobject_cast<Client *>( o );
+		if( c != NULL && c->isVisible() && m_dirtyTiles.contains( c ) )
+		{
+			dirty += c->geometry();
+		}
+	}
+
+	m_dirtyTiles.clear();
+
+	if( !dirty.isEmpty() )
+	{
+		update( dirty );
+	}
+}
+
+
+
+
+void clientWorkspace::reloadTiles()
+{
+	m_reloadTimer.start( m_mainWindow->getClassroomManager()->updateInterval() );
+
+	foreach( QObject * o, children() )
+	{
+		Client * c = qobject_cast<Client *>( o );
+		if( c != NULL )
+		{
+			c->reload();
+		}
+	}
+}
+
+
+
+
 void clientWorkspace::contextMenuEvent( QContextMenuEvent * _event )
 {
 	m_contextMenu->exec( _event->globalPos() );
@@ -623,3 +697,28 @@ void clientWorkspace::contextMenuEvent( QContextMenuEvent * _event )
 
 
 
+
+void clientWorkspace::paintEvent( QPaintEvent * _event )
+{
+	QPainter p( this );
+
+	// children are ordered by stacking order so raised clients are drawn last
+	foreach( QObject * o, children() )
+	{
+		Client * c = qobject_cast<Client *>( o );
+		if( c == NULL || !c->isVisible() ||
+				!_event->region().intersects( c->geometry() ) )
+		{
+			continue;
+		}
+
+		p.save();
+		p.translate( c->pos() );
+		p.setClipRect( c->rect() );
+		c->paintTile( p );
+		p.restore();
+	}
+}
+
+
+
@@ -25,7 +25,9 @@
 #ifndef MAIN_WINDOW_H
 #define MAIN_WINDOW_H
 
+#include <QtCore/QSet>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 #include <QPointer>
 #include <QButtonGroup>
 #include <QMainWindow>
@@ -73,21 +75,43 @@ private:
 } ;
 
 
+// canvas for all clients - client widgets do not paint anything themselves
+// but let the workspace paint all dirty tiles at once in a single paint event
+// - also reloads state of all clients with one timer
 class clientWorkspace : public QWidget
 {
+	Q_OBJECT
 public:
-	clientWorkspace( QScrollArea * _parent );
+	clientWorkspace( QScrollArea * _parent, MainWindow * _main_window );
 	virtual ~clientWorkspace()
 	{
 	}
 
 	virtual QSize sizeHint( void ) const;
 
+	// schedules repainting given client with next frame
+	void updateTile( Client * _client );
+
+
+private slots:
+	void paintDirtyTiles();
+	void reloadTiles();
+
 
 private:
+	enum {
+		// tiles are updated with at most 20 fps
+		FrameInterval = 50
+	} ;
+
 	virtual void contextMenuEvent( QContextMenuEvent * _event );
+	virtual void paintEvent( QPaintEvent * _event );
 
+	MainWindow * m_mainWindow;
 	QMenu * m_contextMenu;
+	QSet<Client *> m_dirtyTiles;
+	QTimer m_frameTimer;
+	QTimer m_reloadTimer;
 
 	friend class MainWindow;
 
@@ -104,7 +128,7 @@ public:
 
 	static bool initAuthentication();
 
-	QWidget * workspace()
+	clientWorkspace * workspace()
 	{
 		return m_workspace;
 	}
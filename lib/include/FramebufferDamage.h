@@ -0,0 +1,65 @@
+/*
+ * FramebufferDamage.h - declaration of FramebufferDamage class
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef FRAMEBUFFER_DAMAGE_H
+#define FRAMEBUFFER_DAMAGE_H
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QRect>
+#include <QtGui/QRegion>
+
+
+// collects rectangles updated by the connection thread in a ring buffer so
+// any number of consumers (e.g. GUI thread) can pick them up without
+// locking - each consumer keeps track of its own position
+class FramebufferDamage
+{
+public:
+	enum {
+		MaxRects = 256
+	} ;
+
+	FramebufferDamage();
+
+	// must only be called by one thread
+	void add( const QRect &rect );
+
+	// position after the most recently added rect
+	quint32 position() const
+	{
+		return m_count.loadAcquire();
+	}
+
+	// returns region damaged since given position and advances position -
+	// if the consumer fell behind too far the whole bounds are returned
+	QRegion take( quint32 *position, const QRect &bounds ) const;
+
+
+private:
+	QRect m_rects[MaxRects];
+	QAtomicInteger<quint32> m_count;
+
+} ;
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * FramebufferScaler.h - area averaging downscaler for framebuffers
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef FRAMEBUFFER_SCALER_H
+#define FRAMEBUFFER_SCALER_H
+
+#include <QtGui/QImage>
+
+
+// reduces RGB32 images by averaging all source pixels covered by a target
+// pixel according to their exact share - works with any (also fractional)
+// ratio and calculates each target pixel independently of its neighbours so
+// parts of an image can be scaled without artifacts at their edges
+//
+// the best implementation for the CPU we're running on (AVX2, SSE2 or plain
+// C++) is selected once at startup
+namespace FramebufferScaler
+{
+	enum {
+		// weights get too coarse for stronger reductions
+		MaxRatio = 32
+	} ;
+
+	// whether source can be scaled to size - size must not be larger than
+	// source in any dimension
+	bool canScale( const QImage &source, const QSize &size );
+
+	// scales source to size of target and only writes the pixels within
+	// given rect of target which has to be of format RGB32
+	void scale( const QImage &source, QImage *target, const QRect &rect );
+
+	QImage scaled( const QImage &source, const QSize &size );
+
+	// name of selected implementation for debugging purposes
+	const char *implementation();
+}
+
+#endif
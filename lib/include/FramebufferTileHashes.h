@@ -0,0 +1,80 @@
+/*
+ * FramebufferTileHashes.h - hashes of framebuffer tiles for verification
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef FRAMEBUFFER_TILE_HASHES_H
+#define FRAMEBUFFER_TILE_HASHES_H
+
+#include <QtCore/QBitArray>
+#include <QtCore/QByteArray>
+#include <QtCore/QVector>
+
+#include <rfb/rfbproto.h>
+
+
+// instead of regularly requesting the whole framebuffer, the master sends
+// hashes of the tiles it has and the server only re-sends differing tiles
+//
+// hashes only cover the colour bits of 32 bit pixels and are calculated
+// from the pixel data as sent by the server so master and server get the
+// same values independent of their byte orders
+namespace FramebufferTileHashes
+{
+	enum {
+		TileSize = 32
+	} ;
+
+	// data exchanged with socket dispatchers for SocketVerifyFramebuffer
+	struct Verification
+	{
+		int tileSize;
+		int width;
+		int height;
+		int tileCount;
+		const quint32 *hashes;
+		// tiles the master received lossy (e.g. as JPEG) whose hashes can't
+		// match and therefore are not compared
+		const QBitArray *lossyTiles;
+		int differingTiles;		// set by dispatcher
+	} ;
+
+	int tileCount( int width, int height, int tileSize = TileSize );
+
+	// selects colour bits of pixels in given format read as little endian
+	// 32 bit words
+	quint32 colorMask( const rfbPixelFormat &format );
+
+	quint32 hashTile( const uchar *data, int bytesPerLine,
+						int width, int height, quint32 mask );
+
+	// hashes of all tiles row by row
+	QVector<quint32> hashes( const uchar *data, int bytesPerLine,
+								int width, int height, quint32 mask,
+								int tileSize = TileSize );
+
+	// (de)serialization for ItalcCore::Msg
+	QByteArray toByteArray( const QVector<quint32> &hashes );
+	QVector<quint32> fromByteArray( const QByteArray &data );
+}
+
+#endif
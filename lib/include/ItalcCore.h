@@ -77,19 +77,68 @@ namespace ItalcCore
 	extern const Command DemoServerAllowHost;
 	extern const Command DemoServerUnallowHost;
 	extern const Command ReportSlaveStateFlags;
+	extern const Command SetThumbnailSize;
+	extern const Command VerifyFramebuffer;
+	extern const Command Acknowledge;
+	extern const Command SubscribeNotifications;
+
+	// static commands are sent as IDs in framed messages and dispatched by
+	// them - new commands have to be appended to keep existing IDs
+	enum CommandIds
+	{
+		GetUserInformationId,
+		UserInformationId,
+		StartDemoId,
+		StopDemoId,
+		LockScreenId,
+		UnlockScreenId,
+		LockInputId,
+		UnlockInputId,
+		LogonUserId,
+		LogoutUserId,
+		DisplayTextMessageId,
+		AccessDialogId,
+		ExecCmdsId,
+		PowerOnComputerId,
+		PowerDownComputerId,
+		RestartComputerId,
+		DisableLocalInputsId,
+		SetRoleId,
+		StartDemoServerId,
+		StopDemoServerId,
+		DemoServerAllowHostId,
+		DemoServerUnallowHostId,
+		ReportSlaveStateFlagsId,
+		SetThumbnailSizeId,
+		VerifyFramebufferId,
+		AcknowledgeId,
+		SubscribeNotificationsId,
+		CommandIdCount,
+		// commands of plugins are sent by name
+		UnknownCommandId = 0xffff
+	} ;
+
+	int commandId( const Command &cmd );
+	Command commandById( int id );
 
 	class Msg
 	{
 	public:
 		Msg( SocketDevice *sockDev, const Command &cmd = Command() ) :
 			m_socketDevice( sockDev ),
-			m_cmd( cmd )
+			m_cmd( cmd ),
+			m_cmdId( commandId( cmd ) ),
+			m_args(),
+			m_framed( false )
 		{
 		}
 
 		Msg( const Command &cmd ) :
 			m_socketDevice( NULL ),
-			m_cmd( cmd )
+			m_cmd( cmd ),
+			m_cmdId( commandId( cmd ) ),
+			m_args(),
+			m_framed( false )
 		{
 		}
 
@@ -98,6 +147,11 @@ namespace ItalcCore
 			return m_cmd;
 		}
 
+		int cmdId() const
+		{
+			return m_cmdId;
+		}
+
 		const CommandArgs &args() const
 		{
 			return m_args;
@@ -120,20 +174,68 @@ namespace ItalcCore
 			return *this;
 		}
 
+		Msg &addArg( const QString &key, const QByteArray &value )
+		{
+			m_args[key.toLower()] = value;
+			return *this;
+		}
+
 		QString arg( const QString &key ) const
 		{
 			return m_args[key.toLower()].toString();
 		}
 
+		QByteArray byteArrayArg( const QString &key ) const
+		{
+			return m_args[key.toLower()].toByteArray();
+		}
+
+		// framed messages are serialized into one length-prefixed buffer
+		// which is written and read at once - must only be sent to peers
+		// which announced to support them
+		Msg &setFramed( bool framed )
+		{
+			m_framed = framed;
+			return *this;
+		}
+
+		bool isFramed() const
+		{
+			return m_framed;
+		}
+
+		// lets messages in old format announce that sender is able to
+		// receive framed messages
+		Msg &announceFraming()
+		{
+			return addArg( "framing", FramingVersion );
+		}
+
+		bool senderSupportsFraming() const
+		{
+			return m_framed || arg( "framing" ).toInt() >= FramingVersion;
+		}
+
+		// serializes message the way send() writes it so it can be sent
+		// to many peers without encoding it for each of them
+		QByteArray encode() const;
+
 		bool send();
 		Msg &receive();
 
 
 	private:
+		enum {
+			FramingVersion = 1,
+			MaxFrameSize = 16*1024*1024
+		} ;
+
 		SocketDevice *m_socketDevice;
 
 		Command m_cmd;
+		int m_cmdId;
 		CommandArgs m_args;
+		bool m_framed;
 
 	} ;
 
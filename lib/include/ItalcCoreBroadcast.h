@@ -0,0 +1,107 @@
+/*
+ * ItalcCoreBroadcast.h - declaration of ItalcCoreBroadcast class
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef ITALC_CORE_BROADCAST_H
+#define ITALC_CORE_BROADCAST_H
+
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QStringList>
+#include <QtCore/QTimer>
+
+#include "ItalcCore.h"
+
+class ItalcCoreConnection;
+
+
+// collects acknowledgements of a message sent to many servers at once by
+// ItalcCoreConnection::broadcast() - deletes itself after finished() has
+// been emitted
+class ItalcCoreBroadcast : public QObject
+{
+	Q_OBJECT
+public:
+	enum {
+		// servers not acknowledging within this time (in ms) are given up
+		AcknowledgeTimeout = 10000
+	} ;
+
+	const ItalcCore::Command &cmd() const
+	{
+		return m_cmd;
+	}
+
+	int hostCount() const
+	{
+		return m_hostCount;
+	}
+
+	// round trip times in ms of all hosts which acknowledged the message
+	const QMap<QString, qint64> &latencies() const
+	{
+		return m_latencies;
+	}
+
+	QStringList pendingHosts() const
+	{
+		return m_pendingHosts.values();
+	}
+
+	bool isFinished() const
+	{
+		return m_finished;
+	}
+
+signals:
+	void acknowledged( const QString &host, qint64 latency );
+	void finished();
+
+
+private slots:
+	void acknowledge( int requestId, qint64 receiveTime );
+	void connectionDestroyed( QObject *connection );
+	void finish();
+
+
+private:
+	ItalcCoreBroadcast( const ItalcCore::Command &cmd, int requestId );
+
+	// has to be called before message is enqueued for connection
+	void addConnection( ItalcCoreConnection *connection );
+	void start();
+
+	const ItalcCore::Command m_cmd;
+	const int m_requestId;
+	qint64 m_startTime;
+	int m_hostCount;
+	QHash<QObject *, QString> m_pendingHosts;
+	QMap<QString, qint64> m_latencies;
+	QTimer m_timeoutTimer;
+	bool m_finished;
+
+	friend class ItalcCoreConnection;
+
+} ;
+
+#endif
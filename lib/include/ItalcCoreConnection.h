@@ -25,9 +25,13 @@
 #ifndef ITALC_CORE_CONNECTION_H
 #define ITALC_CORE_CONNECTION_H
 
+#include <QtCore/QVector>
+
 #include "ItalcCore.h"
 #include "ItalcVncConnection.h"
 
+class ItalcCoreBroadcast;
+
 
 class ItalcCoreConnection : public QObject
 {
@@ -66,6 +70,13 @@ public:
 		return m_slaveStateFlags;
 	}
 
+	// whether server pushes changes of user information and slave state
+	// flags so they don't have to be requested regularly
+	bool receivesNotifications() const
+	{
+		return m_receivesNotifications;
+	}
+
 #define GEN_SLAVE_STATE_HELPER(x)							\
 			bool is##x() const								\
 			{												\
@@ -79,39 +90,56 @@ public:
 	GEN_SLAVE_STATE_HELPER(SystemTrayIconRunning)
 	GEN_SLAVE_STATE_HELPER(MessageBoxRunning)
 
-	void sendGetUserInformationRequest();
-	void execCmds( const QString &cmd );
-	void startDemo( const QString &host, int port, bool fullscreen = false );
-	void stopDemo();
-	void lockScreen();
-	void unlockScreen();
-	void lockInput();
-	void unlockInput();
+	// all requests return their ID which is passed to acknowledged() once
+	// the server handled them - older servers never acknowledge anything
+	int sendGetUserInformationRequest();
+	int execCmds( const QString &cmd );
+	int startDemo( const QString &host, int port, bool fullscreen = false );
+	int stopDemo();
+	int lockScreen();
+	int unlockScreen();
+	int lockInput();
+	int unlockInput();
 	void logonUser( const QString &uname, const QString &pw,
 						const QString &domain );
-	void logoutUser();
-	void displayTextMessage( const QString& title, const QString &msg );
+	int logoutUser();
+	int displayTextMessage( const QString& title, const QString &msg );
+
+	int powerOnComputer( const QString &mac );
+	int powerDownComputer();
+	int restartComputer();
+	int disableLocalInputs( bool disabled );
 
-	void powerOnComputer( const QString &mac );
-	void powerDownComputer();
-	void restartComputer();
-	void disableLocalInputs( bool disabled );
+	int setRole( const ItalcCore::UserRole role );
 
-	void setRole( const ItalcCore::UserRole role );
+	int startDemoServer( int sourcePort, int destinationPort );
+	int stopDemoServer();
+	int demoServerAllowHost( const QString &host );
+	int demoServerUnallowHost( const QString &host );
 
-	void startDemoServer( int sourcePort, int destinationPort );
-	void stopDemoServer();
-	void demoServerAllowHost( const QString &host );
-	void demoServerUnallowHost( const QString &host );
+	int reportSlaveStateFlags();
 
-	void reportSlaveStateFlags();
+	// asks server to scale down framebuffer for this connection so it still
+	// covers given size - an invalid size requests full resolution again
+	void setThumbnailSize( const QSize &size );
+
+	// sends given message to all connected servers in parallel - it is
+	// encoded only once for all connections - returned object collects
+	// acknowledgements of servers
+	static ItalcCoreBroadcast *broadcast(
+							const QVector<ItalcCoreConnection *> &connections,
+							const ItalcCore::Msg &msg );
 
 signals:
 	void receivedUserInfo( const QString &, const QString & );
 	void receivedSlaveStateFlags( const int );
+	// emitted by connection thread for acknowledgements and answers to
+	// requests - receiveTime is based on the reference of QElapsedTimer
+	void acknowledged( int requestId, qint64 receiveTime );
 
 private slots:
 	void initNewClient( rfbClient *client );
+	void restoreConnectionSettings();
 
 
 private:
@@ -119,7 +147,8 @@ private:
 						rfbServerToClientMsg *msg );
 
 	bool handleServerMessage( rfbClient *cl, uint8_t msg );
-	void enqueueMessage( const ItalcCore::Msg &msg );
+	int enqueueMessage( const ItalcCore::Msg &msg );
+	static int nextRequestId();
 
 
 	ItalcVncConnection *m_vncConn;
@@ -129,6 +158,16 @@ private:
 
 	int m_slaveStateFlags;
 
+	QSize m_thumbnailSize;
+
+	// whether server sent framed messages so we can send them as well -
+	// only accessed by connection thread
+	bool m_framedMessages;
+
+	volatile bool m_receivesNotifications;
+
+	friend class ItalcMessageEvent;
+
 } ;
 
 
@@ -61,6 +61,10 @@ enum ItalcAuthTypes
 	// secret
 	ItalcAuthCommonSecret,
 
+	// client presents a ticket issued after previous DSA authentication or
+	// falls back to DSA authentication and receives a new ticket
+	ItalcAuthTicket,
+
 	NumItalcAuthTypes
 
 } ;
@@ -28,6 +28,8 @@
 #ifndef ITALC_VNC_CONNECTION_H
 #define ITALC_VNC_CONNECTION_H
 
+#include <QtCore/QBitArray>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QMutex>
 #include <QtCore/QQueue>
 #include <QtCore/QReadWriteLock>
@@ -37,9 +39,12 @@
 #include <QtCore/QWaitCondition>
 #include <QtGui/QImage>
 
+#include "FramebufferDamage.h"
 #include "ItalcCore.h"
 #include "ItalcRfbExt.h"
+#include "ScaledFramebuffer.h"
 
+class PointerClientEvent;
 class PrivateDSAKey;
 
 extern "C"
@@ -84,11 +89,32 @@ public:
 	} ;
 	typedef States State;
 
+	// hint for ItalcVncConnectionPool how important updates of a connection
+	// are compared to the other ones
+	enum UpdatePriorities
+	{
+		LowUpdatePriority,		// e.g. thumbnail scrolled out of view
+		NormalUpdatePriority,
+		HighUpdatePriority		// e.g. enlarged thumbnail
+	} ;
+
 	explicit ItalcVncConnection( QObject *parent = 0 );
 	virtual ~ItalcVncConnection();
 
 	const QImage image( int x = 0, int y = 0, int w = 0, int h = 0 ) const;
 	void stop( bool deleteAfterFinished = false );
+
+	// keeps connection established but stops requesting updates so it can
+	// be resumed without connecting and authenticating again - only pooled
+	// connections can be paused, all others are stopped
+	void pause();
+	void resume();
+
+	bool isPaused() const
+	{
+		return m_paused;
+	}
+
 	void reset( const QString &host );
 	void setHost( const QString &host );
 	void setPort( int port );
@@ -100,7 +126,21 @@ public:
 
 	bool isConnected() const
 	{
-		return state() == Connected && isRunning();
+		return state() == Connected && isActive();
+	}
+
+	// thumbnail connections are not served by an own thread but by the
+	// I/O threads of ItalcVncConnectionPool
+	bool isPooled() const
+	{
+		return m_quality == ThumbnailQuality;
+	}
+
+	// returns whether connection thread is running or connection is being
+	// served by ItalcVncConnectionPool
+	bool isActive() const
+	{
+		return isRunning() || m_attachedToPool;
 	}
 
 	bool waitForConnected( int timeout = 10000 ) const;
@@ -130,6 +170,8 @@ public:
 		return m_quality;
 	}
 
+	// wakes up connection thread so events do not wait for the rest of the
+	// framebuffer update interval
 	void enqueueEvent( ClientEvent *e );
 
 	const rfbClient *getRfbClient() const
@@ -147,11 +189,25 @@ public:
 		return m_image.size();
 	}
 
+	// size of framebuffer as announced by server when connecting, i.e.
+	// without server-side scaling requested later on
+	QSize nativeFramebufferSize() const
+	{
+		return m_nativeFramebufferSize;
+	}
+
 	bool framebufferInitialized() const
 	{
 		return m_framebufferInitialized;
 	}
 
+	// rectangles updated by connection thread - allows picking them up at
+	// an own rate instead of handling imageUpdated() for each of them
+	const FramebufferDamage &damage() const
+	{
+		return m_damage;
+	}
+
 	void setScaledSize( const QSize &s )
 	{
 		if( m_scaledSize != s )
@@ -164,13 +220,44 @@ public:
 	QImage scaledScreen()
 	{
 		rescaleScreen();
-		return m_scaledScreen;
+		return m_scaledScreen.image();
 	}
 
 	void setFramebufferUpdateInterval( int interval );
 
+	int framebufferUpdateInterval() const
+	{
+		return m_framebufferUpdateInterval;
+	}
+
+	void setUpdatePriority( UpdatePriorities priority )
+	{
+		m_updatePriority = priority;
+	}
+
+	UpdatePriorities updatePriority() const
+	{
+		return m_updatePriority;
+	}
+
+	// returns number of milliseconds since screen changed the last time
+	qint64 idleTime() const
+	{
+		return m_lastChange.isValid() ? m_lastChange.elapsed() : 0;
+	}
+
 	void rescaleScreen();
 
+	// lets connection verify its framebuffer by sending tile hashes instead
+	// of requesting full updates - requires answers of server to be passed
+	// to framebufferVerified() by the handler of iTALC messages
+	void enableFramebufferVerification()
+	{
+		m_framebufferVerificationEnabled = true;
+	}
+
+	void framebufferVerified( int differingTiles );
+
 	// authentication
 	static void handleSecTypeItalc( rfbClient *client );
 	static void handleMsLogonIIAuth( rfbClient *client );
@@ -208,9 +295,45 @@ protected:
 
 private:
 	enum {
-		ThreadTerminationTimeout = 10000
+		ThreadTerminationTimeout = 10000,
+		// full updates are requested every that many update intervals
+		FullUpdateIntervals = 10,
+		// screens without changes get full updates up to that many times
+		// less often
+		MaxFullUpdateBackoff = 8,
+		// seconds a pooled connection may stall in the middle of a message
+		// before it's dropped so it doesn't block the other connections of
+		// its I/O thread
+		PooledReadTimeout = 5
 	};
 
+	enum FramebufferVerificationStates
+	{
+		VerificationUntested,
+		VerificationSupported,
+		VerificationUnsupported
+	} ;
+
+	// starts own thread or attaches to ItalcVncConnectionPool
+	void startConnection();
+
+	// single steps of connection handling - used by doConnection() and
+	// ItalcVncConnectionPool
+	bool connectToServer();
+	int reconnectInterval() const;
+	bool handleServerMessages();
+	void sendFramebufferUpdateRequests();
+	bool isFullUpdateDue() const;
+	void scheduleFullUpdate();
+	bool sendFramebufferVerification();
+	void updateLossyTiles( const QRect &rect, bool lossy );
+	void fireClientEvents();
+	void closeConnection();
+
+	// called by ItalcVncConnectionPool after connection has been closed
+	// and is not referenced by the pool anymore
+	void detachedFromPool();
+
 	void finishFrameBufferUpdate();
 
 	// hooks for LibVNCClient
@@ -226,6 +349,7 @@ private:
 	static void framebufferCleanup( void* framebuffer );
 
 	bool m_framebufferInitialized;
+	bool m_framebufferDataReceived;
 	rfbClient *m_cl;
 	ItalcAuthType m_italcAuthType;
 	QualityLevels m_quality;
@@ -234,18 +358,51 @@ private:
 	QTimer m_terminateTimer;
 	QWaitCondition m_updateIntervalSleeper;
 	int m_framebufferUpdateInterval;
+	volatile UpdatePriorities m_updatePriority;
 	QTime m_lastFullUpdate;
+	int m_fullUpdateBackoff;
+	int m_fullUpdateJitter;
+	int m_updatesSinceFullUpdate;
+	QElapsedTimer m_lastChange;
+	bool m_framebufferVerificationEnabled;
+	FramebufferVerificationStates m_framebufferVerification;
+	bool m_framebufferVerificationPending;
+	// tiles of framebuffer last updated with lossy encodings - excluded
+	// from verification
+	QBitArray m_lossyTiles;
 	QMutex m_mutex;
 	mutable QReadWriteLock m_imgLock;
 	QQueue<ClientEvent *> m_eventQueue;
+	// last event in queue if it is a pointer move further moves can be
+	// merged into - protected by m_mutex as well as the button mask of the
+	// last pointer event
+	PointerClientEvent *m_pendingPointerEvent;
+	int m_pointerButtonMask;
 
 	QImage m_image;
+	FramebufferDamage m_damage;
+	QSize m_nativeFramebufferSize;
 	bool m_scaledScreenNeedsUpdate;
-	QImage m_scaledScreen;
+	ScaledFramebuffer m_scaledScreen;
+	quint32 m_scaledScreenDamagePosition;
 	QSize m_scaledSize;
 
 	volatile State m_state;
 
+	volatile bool m_paused;
+	// pause state applied to m_cl by connection thread
+	bool m_updatesPaused;
+
+	// issued by server after authentication - only accessed by connection
+	// thread while authenticating
+	QByteArray m_sessionTicket;
+
+	volatile bool m_attachedToPool;
+	bool m_deleteAfterDetach;
+
+	friend class ItalcVncConnectionPool;
+	friend class ItalcVncIoThread;
+	friend class ItalcVncConnectTask;
 
 } ;
 
@@ -0,0 +1,116 @@
+/*
+ * ItalcVncConnectionPool.h - declaration of ItalcVncConnectionPool class
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef ITALC_VNC_CONNECTION_POOL_H
+#define ITALC_VNC_CONNECTION_POOL_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+
+class ItalcVncConnection;
+class ItalcVncIoThread;
+
+
+// serves pooled ItalcVncConnections (i.e. thumbnails in classroom overview)
+// by a small fixed number of I/O threads each waiting for messages of many
+// connections at once instead of running one thread per connection -
+// connecting is blocking and therefore done on a separate bounded pool
+class ItalcVncConnectionPool
+{
+public:
+	enum {
+		MaxIoThreads = 4,
+		// stay below FD_SETSIZE which is 64 on Windows
+		MaxConnectionsPerThread = 60,
+		MaxConnectThreads = 8,
+		// upper limit for latency of client events and removals
+		MaxWaitTime = 50,
+		// global budget of framebuffer updates handled per second - the
+		// update interval of all connections is stretched as required
+		MaxUpdatesPerSecond = 100,
+		// global budget of full framebuffer updates requested per second
+		MaxFullUpdatesPerSecond = 10,
+		// factor by which update interval is changed for connections with
+		// low or high update priority
+		UpdatePriorityFactor = 4,
+		// connections without changes for that many update intervals are
+		// served like ones with low update priority so the global budget
+		// goes to recently changed screens first
+		IdleUpdateIntervals = 10,
+		// number of paused connections kept established
+		MaxPausedConnections = 64
+	} ;
+
+	static ItalcVncConnectionPool *instance();
+
+	void add( ItalcVncConnection *connection );
+
+	// connection is closed and detached asynchronously unless wait is true
+	void remove( ItalcVncConnection *connection, bool wait = false );
+
+	// keeps track of paused connections - returns the least recently paused
+	// one if there are too many of them so it can be stopped
+	ItalcVncConnection *pause( ItalcVncConnection *connection );
+	void resume( ItalcVncConnection *connection );
+
+	// returns whether given connection may request a full framebuffer update
+	// now - connections with low priority only get what others leave over
+	bool acquireFullUpdate( const ItalcVncConnection *connection );
+
+
+private:
+	ItalcVncConnectionPool();
+	~ItalcVncConnectionPool();
+
+	ItalcVncIoThread *leastLoadedThread();
+
+	// time until messages of given connection are handled next time -
+	// has to be called with mutex locked
+	qint64 updateInterval( const ItalcVncConnection *connection ) const;
+
+	// protects all data of pool and its I/O threads
+	QMutex m_mutex;
+	QWaitCondition m_detached;
+	QElapsedTimer m_clock;
+
+	QVector<ItalcVncIoThread *> m_ioThreads;
+	QHash<ItalcVncConnection *, ItalcVncIoThread *> m_assignments;
+	// least recently paused connection first
+	QList<ItalcVncConnection *> m_pausedConnections;
+	QThreadPool m_connectPool;
+
+	double m_fullUpdateTokens;
+	qint64 m_lastFullUpdateRefill;
+
+	friend class ItalcVncIoThread;
+	friend class ItalcVncConnectTask;
+
+} ;
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * ScaledFramebuffer.h - declaration of ScaledFramebuffer class
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef SCALED_FRAMEBUFFER_H
+#define SCALED_FRAMEBUFFER_H
+
+#include <QtGui/QImage>
+#include <QtGui/QRegion>
+
+
+// keeps a scaled copy of a framebuffer and only re-samples the parts of it
+// which have been modified instead of scaling the whole framebuffer again
+class ScaledFramebuffer
+{
+public:
+	ScaledFramebuffer();
+
+	// brings scaled image up to date after the given region of source has
+	// been modified - everything is re-sampled if the size of source or the
+	// requested size changed - returns the modified region of scaled image
+	QRegion update( const QImage &source, const QSize &size,
+					const QRegion &damage );
+
+	const QImage &image() const
+	{
+		return m_image;
+	}
+
+	void clear();
+
+
+private:
+	enum {
+		// smooth scaling of Qt affects neighboured pixels as well
+		Border = 1,
+		// merge damaged rects if there are more than this
+		MaxRects = 16
+	} ;
+
+	QRegion rescale( const QImage &source, const QSize &size );
+	void resample( const QImage &source, const QRect &rect );
+
+	QImage m_image;
+	QSize m_sourceSize;
+
+} ;
+
+#endif
@@ -35,7 +35,23 @@ typedef enum
 {
 	SocketRead,
 	SocketWrite,
-	SocketGetPeerAddress
+	SocketGetPeerAddress,
+	// buffer holds two ints (width, height) the server should scale the
+	// framebuffer down to for this connection - ignored by dispatchers
+	// which do not support server-side scaling
+	SocketSetScaledSize,
+	// buffer holds a FramebufferTileHashes::Verification - dispatchers
+	// supporting it mark differing tiles as modified and return a positive
+	// value
+	SocketVerifyFramebuffer,
+	// dispatchers able to send messages to the client on their own return
+	// a positive value and from now on call
+	// ItalcCoreServer::sendNotifications() whenever it is safe to send
+	// and ItalcCoreServer::unsubscribeNotifications() when client is gone
+	SocketSubscribeNotifications,
+	// makes dispatchers supporting notifications send an update soon so
+	// pending notifications are delivered even if the screen is idle
+	SocketFlushNotifications
 } SocketOpCodes;
 
 
@@ -30,9 +30,11 @@
 #include <QtCore/QEvent>
 #include <QtCore/QPointer>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 #include <QWidget>
 
 #include "ItalcVncConnection.h"
+#include "ScaledFramebuffer.h"
 
 
 class ProgressWidget;
@@ -95,11 +97,16 @@ private slots:
 	void checkKeyEvent( unsigned int key, bool pressed );
 	void updateCursorPos( int x, int y );
 	void updateCursorShape( const QImage &cursorShape, int xh, int yh );
-	void updateImage( int x, int y, int w, int h );
+	void scheduleRepaint();
+	void repaintDamage();
 	void updateSizeHint( int w, int h );
 
 
 private:
+	enum {
+		RepaintInterval = 16	// ms, i.e. about 60 fps
+	} ;
+
 	virtual bool eventFilter( QObject * _obj, QEvent * _event );
 	virtual bool event( QEvent * _ev );
 	virtual void focusInEvent( QFocusEvent * );
@@ -121,9 +128,10 @@ private:
 	QPointer<ItalcVncConnection> m_vncConn;
 
 	Mode m_mode;
-	int m_x, m_y, m_w, m_h;
-	bool m_repaint;
 	QImage m_frame;
+	ScaledFramebuffer m_scaledFrame;
+	QTimer m_repaintTimer;
+	quint32 m_damagePosition;
 	QImage m_cursorShape;
 	int m_cursorX;
 	int m_cursorY;
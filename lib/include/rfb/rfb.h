@@ -1009,6 +1009,10 @@ void rfbDoCopyRegion(rfbScreenInfoPtr rfbScreen,sraRegionPtr copyRegion,int dx,i
 
 void rfbMarkRectAsModified(rfbScreenInfoPtr rfbScreen,int x1,int y1,int x2,int y2);
 void rfbMarkRegionAsModified(rfbScreenInfoPtr rfbScreen,sraRegionPtr modRegion);
+/** called with every region of the framebuffer which has been modified or
+    copied, no matter whether any clients are connected */
+typedef void (*rfbFramebufferModifiedProc)(rfbScreenInfoPtr rfbScreen,sraRegionPtr region);
+extern rfbFramebufferModifiedProc rfbFramebufferModified;
 void rfbDoNothingWithClient(rfbClientPtr cl);
 enum rfbNewClientAction defaultNewClientHook(rfbClientPtr cl);
 void rfbRegisterProtocolExtension(rfbProtocolExtension* extension);
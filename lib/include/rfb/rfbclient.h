@@ -367,6 +367,14 @@ typedef struct _rfbClient {
 	LockWriteToTLSProc LockWriteToTLS;
 	UnlockWriteToTLSProc UnlockWriteToTLS;
 
+	/** Seconds ReadFromRFBServer() waits for further data of a partially
+	    received message before failing - 0 (default) waits forever */
+	int readTimeout;
+
+	/** Whether pixels of the rectangle passed to GotFrameBufferUpdate may
+	    differ from the ones of the server (e.g. Tight JPEG) */
+	rfbBool lastRectLossy;
+
 } rfbClient;
 
 /* cursor.c */
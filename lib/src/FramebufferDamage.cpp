@@ -0,0 +1,77 @@
+/*
+ * FramebufferDamage.cpp - implementation of FramebufferDamage class
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <atomic>
+
+#include "FramebufferDamage.h"
+
+
+FramebufferDamage::FramebufferDamage() :
+	m_count( 0 )
+{
+}
+
+
+
+
+void FramebufferDamage::add( const QRect &rect )
+{
+	// only one thread modifies m_count so no need for atomic increment
+	const quint32 n = m_count.load();
+	m_rects[n % MaxRects] = rect;
+	m_count.storeRelease( n + 1 );
+}
+
+
+
+
+QRegion FramebufferDamage::take( quint32 *position, const QRect &bounds ) const
+{
+	const quint32 count = m_count.loadAcquire();
+
+	// while the slot for rect n is written, m_count is n so a distance of
+	// MaxRects already means the oldest entry might be overwritten
+	QRegion region;
+	bool overflow = count - *position >= MaxRects;
+	if( overflow == false )
+	{
+		for( quint32 i = *position; i != count; ++i )
+		{
+			region += m_rects[i % MaxRects];
+		}
+
+		// entries might have been overwritten while reading them
+		std::atomic_thread_fence( std::memory_order_acquire );
+		overflow = m_count.loadAcquire() - *position >= MaxRects;
+	}
+
+	*position = count;
+
+	if( overflow )
+	{
+		return QRegion( bounds );
+	}
+
+	return region.intersected( bounds );
+}
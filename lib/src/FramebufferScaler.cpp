@@ -0,0 +1,383 @@
+/*
+ * FramebufferScaler.cpp - area averaging downscaler for framebuffers
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <italcconfig.h>
+
+#include <stdint.h>
+
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+
+#include "FramebufferScaler.h"
+
+#if defined(__GNUC__) && ( defined(ITALC_HOST_X86) || defined(ITALC_HOST_X86_64) )
+#define ITALC_HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+// source rows are summed up into 16 bit values first which then are reduced
+// horizontally using _mm_madd_epi16() so the accumulated values must not
+// exceed the range of signed 16 bit integers
+enum {
+	RowWeightSum = 128,
+	ColumnWeightSum = 256,
+	WeightShift = 15		// log2( RowWeightSum * ColumnWeightSum )
+} ;
+
+
+// source pixels covered by each target pixel of one axis and their weights
+struct AxisWeights
+{
+	QVector<int> first;
+	QVector<int> count;
+	QVector<int16_t> weights;
+} ;
+
+
+
+// with pairs set, the number of weights is rounded up to an even number by
+// adding a zero weight for the following source pixel
+static void calculateWeights( int sourceSize, int size, int begin, int end,
+								int weightSum, bool pairs, AxisWeights *w )
+{
+	for( int i = begin; i < end; ++i )
+	{
+		// target pixel i spans [start;stop[ and source pixel s spans
+		// [s*size;(s+1)*size[ which makes all borders integers
+		const int64_t start = (int64_t) i * sourceSize;
+		const int64_t stop = start + sourceSize;
+		const int first = start / size;
+		const int last = ( stop - 1 ) / size;
+
+		// round cumulated coverage so weights always add up to weightSum
+		int64_t covered = 0;
+		int previous = 0;
+		for( int s = first; s <= last; ++s )
+		{
+			covered += qMin<int64_t>( stop, (int64_t) ( s + 1 ) * size ) -
+							qMax<int64_t>( start, (int64_t) s * size );
+			const int current =
+				( covered * weightSum + sourceSize / 2 ) / sourceSize;
+			w->weights += current - previous;
+			previous = current;
+		}
+
+		int count = last - first + 1;
+		if( pairs && count % 2 )
+		{
+			w->weights += 0;
+			++count;
+		}
+
+		w->first += first;
+		w->count += count;
+	}
+}
+
+
+
+static void accumulateRowsRange( const uint8_t * const *rows,
+									const int16_t *weights, int rowCount,
+									int begin, int end, uint16_t *out )
+{
+	for( int i = begin; i < end; ++i )
+	{
+		out[i] = rows[0][i] * weights[0];
+	}
+	for( int r = 1; r < rowCount; ++r )
+	{
+		for( int i = begin; i < end; ++i )
+		{
+			out[i] += rows[r][i] * weights[r];
+		}
+	}
+}
+
+
+
+// sums up count bytes of all given rows according to their weights
+static void accumulateRowsScalar( const uint8_t * const *rows,
+									const int16_t *weights, int rowCount,
+									int count, uint16_t *out )
+{
+	accumulateRowsRange( rows, weights, rowCount, 0, count, out );
+}
+
+
+
+// calculates target pixels from accumulated pixels covered by them
+static void reduceColumnsScalar( const uint16_t *line, const int *first,
+									const int *count, const int16_t *weights,
+									int width, uint32_t *out )
+{
+	for( int x = 0; x < width; ++x )
+	{
+		const uint16_t *p = line + first[x] * 4;
+		uint32_t sum[4] = { 0, 0, 0, 0 } ;
+		for( int k = 0; k < count[x]; ++k, p += 4 )
+		{
+			for( int c = 0; c < 4; ++c )
+			{
+				sum[c] += p[c] * weights[k];
+			}
+		}
+		weights += count[x];
+
+		uint8_t *pixel = (uint8_t *)( out + x );
+		for( int c = 0; c < 4; ++c )
+		{
+			pixel[c] = ( sum[c] + ( 1 << ( WeightShift - 1 ) ) ) >> WeightShift;
+		}
+	}
+}
+
+
+
+#ifdef ITALC_HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void accumulateRowsSSE2( const uint8_t * const *rows,
+								const int16_t *weights, int rowCount,
+								int count, uint16_t *out )
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	int i = 0;
+	for( ; i + 16 <= count; i += 16 )
+	{
+		__m128i lo = zero;
+		__m128i hi = zero;
+		for( int r = 0; r < rowCount; ++r )
+		{
+			const __m128i d = _mm_loadu_si128( (const __m128i *)( rows[r] + i ) );
+			const __m128i w = _mm_set1_epi16( weights[r] );
+			lo = _mm_add_epi16( lo, _mm_mullo_epi16( _mm_unpacklo_epi8( d, zero ), w ) );
+			hi = _mm_add_epi16( hi, _mm_mullo_epi16( _mm_unpackhi_epi8( d, zero ), w ) );
+		}
+		_mm_storeu_si128( (__m128i *)( out + i ), lo );
+		_mm_storeu_si128( (__m128i *)( out + i + 8 ), hi );
+	}
+
+	accumulateRowsRange( rows, weights, rowCount, i, count, out );
+}
+
+
+
+__attribute__((target("sse2")))
+static void reduceColumnsSSE2( const uint16_t *line, const int *first,
+								const int *count, const int16_t *weights,
+								int width, uint32_t *out )
+{
+	const __m128i round = _mm_set1_epi32( 1 << ( WeightShift - 1 ) );
+
+	for( int x = 0; x < width; ++x )
+	{
+		const uint16_t *p = line + first[x] * 4;
+		const int n = count[x];
+
+		// interleave channels of two pixels so _mm_madd_epi16() weights
+		// and adds them in one go - there's always an even number of them
+		__m128i sum = round;
+		for( int k = 0; k < n; k += 2 )
+		{
+			const __m128i a = _mm_loadl_epi64( (const __m128i *)( p + k * 4 ) );
+			const __m128i b = _mm_loadl_epi64( (const __m128i *)( p + k * 4 + 4 ) );
+			const __m128i w = _mm_set1_epi32( (uint16_t) weights[k] |
+										( (uint16_t) weights[k+1] << 16 ) );
+			sum = _mm_add_epi32( sum,
+							_mm_madd_epi16( _mm_unpacklo_epi16( a, b ), w ) );
+		}
+		weights += n;
+
+		sum = _mm_srli_epi32( sum, WeightShift );
+		sum = _mm_packs_epi32( sum, sum );
+		out[x] = _mm_cvtsi128_si32( _mm_packus_epi16( sum, sum ) );
+	}
+}
+
+
+
+__attribute__((target("avx2")))
+static void accumulateRowsAVX2( const uint8_t * const *rows,
+								const int16_t *weights, int rowCount,
+								int count, uint16_t *out )
+{
+	int i = 0;
+	for( ; i + 32 <= count; i += 32 )
+	{
+		__m256i lo = _mm256_setzero_si256();
+		__m256i hi = _mm256_setzero_si256();
+		for( int r = 0; r < rowCount; ++r )
+		{
+			const __m256i w = _mm256_set1_epi16( weights[r] );
+			const __m256i a = _mm256_cvtepu8_epi16(
+						_mm_loadu_si128( (const __m128i *)( rows[r] + i ) ) );
+			const __m256i b = _mm256_cvtepu8_epi16(
+						_mm_loadu_si128( (const __m128i *)( rows[r] + i + 16 ) ) );
+			lo = _mm256_add_epi16( lo, _mm256_mullo_epi16( a, w ) );
+			hi = _mm256_add_epi16( hi, _mm256_mullo_epi16( b, w ) );
+		}
+		_mm256_storeu_si256( (__m256i *)( out + i ), lo );
+		_mm256_storeu_si256( (__m256i *)( out + i + 16 ), hi );
+	}
+
+	for( ; i + 16 <= count; i += 16 )
+	{
+		__m256i sum = _mm256_setzero_si256();
+		for( int r = 0; r < rowCount; ++r )
+		{
+			const __m256i d = _mm256_cvtepu8_epi16(
+						_mm_loadu_si128( (const __m128i *)( rows[r] + i ) ) );
+			sum = _mm256_add_epi16( sum, _mm256_mullo_epi16( d,
+										_mm256_set1_epi16( weights[r] ) ) );
+		}
+		_mm256_storeu_si256( (__m256i *)( out + i ), sum );
+	}
+
+	accumulateRowsRange( rows, weights, rowCount, i, count, out );
+}
+
+#endif
+
+
+
+struct KernelSet
+{
+	void ( * accumulateRows )( const uint8_t * const *, const int16_t *, int,
+																int, uint16_t * );
+	void ( * reduceColumns )( const uint16_t *, const int *, const int *,
+										const int16_t *, int, uint32_t * );
+	const char *name;
+} ;
+
+
+static KernelSet selectKernels()
+{
+#ifdef ITALC_HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	// there's nothing to gain from 256 bit registers when reducing columns
+	// and the AVX2 function clears upper halves before returning so the SSE2
+	// version can be used without transition penalty
+	if( __builtin_cpu_supports( "avx2" ) )
+	{
+		const KernelSet k = { accumulateRowsAVX2, reduceColumnsSSE2, "AVX2" } ;
+		return k;
+	}
+	if( __builtin_cpu_supports( "sse2" ) )
+	{
+		const KernelSet k = { accumulateRowsSSE2, reduceColumnsSSE2, "SSE2" } ;
+		return k;
+	}
+#endif
+	const KernelSet k = { accumulateRowsScalar, reduceColumnsScalar, "scalar" } ;
+	return k;
+}
+
+
+static const KernelSet __kernels = selectKernels();
+
+
+
+namespace FramebufferScaler
+{
+
+bool canScale( const QImage &source, const QSize &size )
+{
+	return source.format() == QImage::Format_RGB32 &&
+			size.isEmpty() == false &&
+			size.width() <= source.width() &&
+			size.height() <= source.height() &&
+			source.width() <= size.width() * MaxRatio &&
+			source.height() <= size.height() * MaxRatio;
+}
+
+
+
+void scale( const QImage &source, QImage *target, const QRect &rect )
+{
+	const QRect r = rect.intersected( target->rect() );
+	if( r.isEmpty() )
+	{
+		return;
+	}
+
+	AxisWeights columns;
+	AxisWeights rows;
+	calculateWeights( source.width(), target->width(), r.left(), r.right() + 1,
+						ColumnWeightSum, true, &columns );
+	calculateWeights( source.height(), target->height(), r.top(), r.bottom() + 1,
+						RowWeightSum, false, &rows );
+
+	// only accumulate source columns covered by rect - a zero weighted pixel
+	// added for pairing might be beyond these or even the image
+	const int x0 = columns.first.first();
+	const int x1 = qMin( source.width(),
+							columns.first.last() + columns.count.last() );
+	for( int &first : columns.first )
+	{
+		first -= x0;
+	}
+
+	QVector<uint16_t> line( ( x1 - x0 + 1 ) * 4 );
+	QVarLengthArray<const uint8_t *, MaxRatio+2> sourceRows;
+
+	const int16_t *rowWeights = rows.weights.constData();
+	for( int y = 0; y < r.height(); ++y )
+	{
+		const int n = rows.count[y];
+		sourceRows.resize( n );
+		for( int i = 0; i < n; ++i )
+		{
+			sourceRows[i] = source.constScanLine( rows.first[y] + i ) + x0 * 4;
+		}
+
+		__kernels.accumulateRows( sourceRows.constData(), rowWeights, n,
+									( x1 - x0 ) * 4, line.data() );
+		rowWeights += n;
+
+		__kernels.reduceColumns( line.constData(), columns.first.constData(),
+									columns.count.constData(),
+									columns.weights.constData(), r.width(),
+						(uint32_t *) target->scanLine( r.top() + y ) + r.left() );
+	}
+}
+
+
+
+QImage scaled( const QImage &source, const QSize &size )
+{
+	QImage target( size, QImage::Format_RGB32 );
+	scale( source, &target, target.rect() );
+	return target;
+}
+
+
+
+const char *implementation()
+{
+	return __kernels.name;
+}
+
+}
@@ -0,0 +1,124 @@
+/*
+ * FramebufferTileHashes.cpp - hashes of framebuffer tiles for verification
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <QtCore/QtEndian>
+
+#include "FramebufferTileHashes.h"
+
+
+namespace FramebufferTileHashes
+{
+
+int tileCount( int width, int height, int tileSize )
+{
+	if( width <= 0 || height <= 0 || tileSize <= 0 )
+	{
+		return 0;
+	}
+
+	return ( ( width + tileSize - 1 ) / tileSize ) *
+				( ( height + tileSize - 1 ) / tileSize );
+}
+
+
+
+quint32 colorMask( const rfbPixelFormat &format )
+{
+	const quint32 mask = ( format.redMax << format.redShift ) |
+							( format.greenMax << format.greenShift ) |
+							( format.blueMax << format.blueShift );
+
+	return format.bigEndian ? qbswap( mask ) : mask;
+}
+
+
+
+quint32 hashTile( const uchar *data, int bytesPerLine,
+					int width, int height, quint32 mask )
+{
+	// FNV-1a on 32 bit words
+	quint32 hash = 2166136261u;
+	for( int y = 0; y < height; ++y )
+	{
+		const uchar *p = data + y * bytesPerLine;
+		for( int x = 0; x < width; ++x, p += 4 )
+		{
+			hash = ( hash ^ ( qFromLittleEndian<quint32>( p ) & mask ) ) *
+																16777619u;
+		}
+	}
+
+	return hash;
+}
+
+
+
+QVector<quint32> hashes( const uchar *data, int bytesPerLine,
+							int width, int height, quint32 mask, int tileSize )
+{
+	QVector<quint32> h;
+	h.reserve( tileCount( width, height, tileSize ) );
+
+	for( int y = 0; y < height; y += tileSize )
+	{
+		for( int x = 0; x < width; x += tileSize )
+		{
+			h += hashTile( data + y * bytesPerLine + x * 4, bytesPerLine,
+							qMin( tileSize, width - x ),
+							qMin( tileSize, height - y ), mask );
+		}
+	}
+
+	return h;
+}
+
+
+
+QByteArray toByteArray( const QVector<quint32> &hashes )
+{
+	QByteArray data( hashes.size() * sizeof( quint32 ), 0 );
+	for( int i = 0; i < hashes.size(); ++i )
+	{
+		qToLittleEndian<quint32>( hashes[i],
+						(uchar *) data.data() + i * sizeof( quint32 ) );
+	}
+
+	return data;
+}
+
+
+
+QVector<quint32> fromByteArray( const QByteArray &data )
+{
+	QVector<quint32> hashes( data.size() / sizeof( quint32 ) );
+	for( int i = 0; i < hashes.size(); ++i )
+	{
+		hashes[i] = qFromLittleEndian<quint32>(
+					(const uchar *) data.constData() + i * sizeof( quint32 ) );
+	}
+
+	return hashes;
+}
+
+}
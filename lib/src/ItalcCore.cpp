@@ -30,6 +30,7 @@
 
 #include <QtCore/QDir>
 #include <QtCore/QFileInfo>
+#include <QtCore/QHash>
 #include <QtCore/QLocale>
 #include <QtCore/QTranslator>
 #include <QApplication>
@@ -83,6 +84,8 @@ qint64 libvncClientDispatcher( char * _buf, const qint64 _len,
 		case SocketGetPeerAddress:
 //			strncpy( _buf, cl->host, _len );
 			break;
+		default:
+			break;
 	}
 	return 0;
 
@@ -303,14 +306,50 @@ namespace ItalcCore
 {
 
 
-bool Msg::send()
+// in old format messages start with the length of the command string which
+// never gets that large so framed messages can be told apart by it
+static const quint32 FramedMsgMarker = 0xfffffffe;
+
+
+
+QByteArray Msg::encode() const
 {
-	QDataStream d( m_socketDevice );
+	QByteArray data;
+	QDataStream d( &data, QIODevice::WriteOnly );
 	d << (uint8_t) rfbItalcCoreRequest;
-	d << m_cmd;
+
+	if( m_framed == false )
+	{
+		d << m_cmd;
+		d << m_args;
+
+		return data;
+	}
+
+	d << FramedMsgMarker;
+	d << (quint32) 0;	// size of payload - filled in below
+	const int headerSize = data.size();
+	d << (quint16) m_cmdId;
+	if( m_cmdId == UnknownCommandId )
+	{
+		d << m_cmd;
+	}
 	d << m_args;
 
-	return true;
+	d.device()->seek( headerSize - sizeof( quint32 ) );
+	d << (quint32) ( data.size() - headerSize );
+
+	return data;
+}
+
+
+
+bool Msg::send()
+{
+	const QByteArray data = encode();
+
+	return m_socketDevice->write( data.constData(), data.size() ) ==
+																data.size();
 }
 
 
@@ -318,8 +357,63 @@ bool Msg::send()
 Msg &Msg::receive()
 {
 	QDataStream d( m_socketDevice );
-	d >> m_cmd;
-	d >> m_args;
+
+	quint32 marker = 0;
+	d >> marker;
+
+	if( marker != FramedMsgMarker )
+	{
+		// old format - marker is the length of the command string
+		if( marker != 0xffffffff && marker > MaxFrameSize )
+		{
+			qCritical() << "ItalcCore::Msg::receive(): invalid command size"
+							<< marker;
+			return *this;
+		}
+
+		QByteArray cmd;
+		QDataStream( &cmd, QIODevice::WriteOnly ) << marker;
+		if( marker != 0xffffffff )
+		{
+			cmd.resize( cmd.size() + marker );
+			m_socketDevice->read( cmd.data() + sizeof( marker ), marker );
+		}
+
+		QDataStream( cmd ) >> m_cmd;
+		m_cmdId = commandId( m_cmd );
+		d >> m_args;
+		m_framed = false;
+
+		return *this;
+	}
+
+	quint32 size = 0;
+	d >> size;
+	if( size > MaxFrameSize )
+	{
+		qCritical() << "ItalcCore::Msg::receive(): invalid frame size" << size;
+		return *this;
+	}
+
+	QByteArray frame( size, 0 );
+	m_socketDevice->read( frame.data(), size );
+
+	QDataStream f( frame );
+	quint16 id = UnknownCommandId;
+	f >> id;
+	if( id == UnknownCommandId )
+	{
+		f >> m_cmd;
+		m_cmdId = commandId( m_cmd );
+	}
+	else
+	{
+		// IDs of commands added later on are not known by us
+		m_cmd = commandById( id );
+		m_cmdId = m_cmd.isEmpty() ? UnknownCommandId : id;
+	}
+	f >> m_args;
+	m_framed = true;
 
 	return *this;
 }
@@ -352,6 +446,79 @@ const Command StopDemoServer = "StopDemoServer";
 
 const Command ReportSlaveStateFlags = "ReportSlaveStateFlags";
 
+const Command SetThumbnailSize = "SetThumbnailSize";
+const Command VerifyFramebuffer = "VerifyFramebuffer";
+const Command Acknowledge = "Acknowledge";
+const Command SubscribeNotifications = "SubscribeNotifications";
+
+
+
+// in order of CommandIds
+static const Command *commandTable[CommandIdCount] =
+{
+	&GetUserInformation,
+	&UserInformation,
+	&StartDemo,
+	&StopDemo,
+	&LockScreen,
+	&UnlockScreen,
+	&LockInput,
+	&UnlockInput,
+	&LogonUserCmd,
+	&LogoutUser,
+	&DisplayTextMessage,
+	&AccessDialog,
+	&ExecCmds,
+	&PowerOnComputer,
+	&PowerDownComputer,
+	&RestartComputer,
+	&DisableLocalInputs,
+	&SetRole,
+	&StartDemoServer,
+	&StopDemoServer,
+	&DemoServerAllowHost,
+	&DemoServerUnallowHost,
+	&ReportSlaveStateFlags,
+	&SetThumbnailSize,
+	&VerifyFramebuffer,
+	&Acknowledge,
+	&SubscribeNotifications
+} ;
+
+
+
+static QHash<Command, int> createCommandIds()
+{
+	QHash<Command, int> ids;
+	for( int i = 0; i < CommandIdCount; ++i )
+	{
+		ids[*commandTable[i]] = i;
+	}
+
+	return ids;
+}
+
+
+
+int commandId( const Command &cmd )
+{
+	static const QHash<Command, int> ids = createCommandIds();
+
+	return ids.value( cmd, UnknownCommandId );
+}
+
+
+
+Command commandById( int id )
+{
+	if( id >= 0 && id < CommandIdCount )
+	{
+		return *commandTable[id];
+	}
+
+	return Command();
+}
+
 
 } ;
 
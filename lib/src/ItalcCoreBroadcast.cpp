@@ -0,0 +1,149 @@
+/*
+ * ItalcCoreBroadcast.cpp - implementation of ItalcCoreBroadcast class
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+
+#include "ItalcCoreBroadcast.h"
+#include "ItalcCoreConnection.h"
+
+
+ItalcCoreBroadcast::ItalcCoreBroadcast( const ItalcCore::Command &cmd,
+														int requestId ) :
+	QObject(),
+	m_cmd( cmd ),
+	m_requestId( requestId ),
+	m_startTime( 0 ),
+	m_hostCount( 0 ),
+	m_pendingHosts(),
+	m_latencies(),
+	m_timeoutTimer( this ),
+	m_finished( false )
+{
+	m_timeoutTimer.setSingleShot( true );
+	m_timeoutTimer.setInterval( AcknowledgeTimeout );
+	connect( &m_timeoutTimer, SIGNAL( timeout() ), this, SLOT( finish() ) );
+}
+
+
+
+
+void ItalcCoreBroadcast::addConnection( ItalcCoreConnection *connection )
+{
+	m_pendingHosts[connection] = connection->vncConnection()->host();
+	++m_hostCount;
+
+	// acknowledgements are received by connection threads
+	connect( connection, SIGNAL( acknowledged( int, qint64 ) ),
+				this, SLOT( acknowledge( int, qint64 ) ),
+				Qt::QueuedConnection );
+	connect( connection, SIGNAL( destroyed( QObject * ) ),
+				this, SLOT( connectionDestroyed( QObject * ) ) );
+}
+
+
+
+
+void ItalcCoreBroadcast::start()
+{
+	QElapsedTimer now;
+	now.start();
+	m_startTime = now.msecsSinceReference();
+
+	if( m_pendingHosts.isEmpty() )
+	{
+		// let caller connect to finished() first
+		QTimer::singleShot( 0, this, SLOT( finish() ) );
+	}
+	else
+	{
+		m_timeoutTimer.start();
+	}
+}
+
+
+
+
+void ItalcCoreBroadcast::acknowledge( int requestId, qint64 receiveTime )
+{
+	QObject *connection = sender();
+	if( requestId != m_requestId || m_finished ||
+			m_pendingHosts.contains( connection ) == false )
+	{
+		return;
+	}
+
+	const QString host = m_pendingHosts.take( connection );
+	const qint64 latency = receiveTime - m_startTime;
+	m_latencies[host] = latency;
+
+	emit acknowledged( host, latency );
+
+	if( m_pendingHosts.isEmpty() )
+	{
+		finish();
+	}
+}
+
+
+
+
+void ItalcCoreBroadcast::connectionDestroyed( QObject *connection )
+{
+	m_pendingHosts.remove( connection );
+
+	if( m_pendingHosts.isEmpty() )
+	{
+		finish();
+	}
+}
+
+
+
+
+void ItalcCoreBroadcast::finish()
+{
+	if( m_finished )
+	{
+		return;
+	}
+
+	m_finished = true;
+	m_timeoutTimer.stop();
+
+	qint64 maxLatency = 0;
+	foreach( qint64 latency, m_latencies )
+	{
+		maxLatency = qMax( maxLatency, latency );
+	}
+
+	qDebug() << "ItalcCoreBroadcast: command" << m_cmd << "acknowledged by"
+				<< m_latencies.size() << "of" << m_hostCount
+				<< "hosts within" << maxLatency << "ms - pending hosts:"
+				<< pendingHosts();
+
+	emit finished();
+
+	deleteLater();
+}
@@ -22,16 +22,37 @@
  *
  */
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+
+#include "ItalcCoreBroadcast.h"
 #include "ItalcCoreConnection.h"
 #include "Logger.h"
 #include "SocketDevice.h"
 
 
+static rfbClientProtocolExtension * __italcProtocolExt = NULL;
+static void * ItalcCoreConnectionTag = (void *) PortOffsetVncServer; // an unique ID
+static QAtomicInt __requestIdCounter;
+
+
+
 class ItalcMessageEvent : public ClientEvent
 {
 public:
 	ItalcMessageEvent( const ItalcCore::Msg &m ) :
-		m_msg( m )
+		m_msg( m ),
+		m_framedData(),
+		m_unframedData()
+	{
+	}
+
+	// message has been encoded in both formats already
+	ItalcMessageEvent( const ItalcCore::Msg &m, const QByteArray &framedData,
+										const QByteArray &unframedData ) :
+		m_msg( m ),
+		m_framedData( framedData ),
+		m_unframedData( unframedData )
 	{
 	}
 
@@ -39,29 +60,52 @@ public:
 	{
 		SocketDevice socketDev( libvncClientDispatcher, client );
 		m_msg.setSocketDevice( &socketDev );
+
+		ItalcCoreConnection *icc = (ItalcCoreConnection *)
+					rfbClientGetClientData( client, ItalcCoreConnectionTag );
+		const bool framed = icc && icc->m_framedMessages;
+
 		qDebug() << "ItalcMessageEvent::fire(): sending message" << m_msg.cmd()
 					<< "with arguments" << m_msg.args();
+
+		if( m_framedData.isEmpty() == false )
+		{
+			const QByteArray &data = framed ? m_framedData : m_unframedData;
+			socketDev.write( data.constData(), data.size() );
+			return;
+		}
+
+		if( framed )
+		{
+			m_msg.setFramed( true );
+		}
+		else
+		{
+			// older servers ignore unknown arguments
+			m_msg.announceFraming();
+		}
+
 		m_msg.send();
 	}
 
 
 private:
 	ItalcCore::Msg m_msg;
+	QByteArray m_framedData;
+	QByteArray m_unframedData;
 
 } ;
 
 
 
-static rfbClientProtocolExtension * __italcProtocolExt = NULL;
-static void * ItalcCoreConnectionTag = (void *) PortOffsetVncServer; // an unique ID
-
-
-
 ItalcCoreConnection::ItalcCoreConnection( ItalcVncConnection *vncConn ):
 	m_vncConn( vncConn ),
 	m_user(),
 	m_userHomeDir(),
-	m_slaveStateFlags( 0 )
+	m_slaveStateFlags( 0 ),
+	m_thumbnailSize(),
+	m_framedMessages( false ),
+	m_receivesNotifications( false )
 {
 	if( __italcProtocolExt == NULL )
 	{
@@ -77,6 +121,11 @@ ItalcCoreConnection::ItalcCoreConnection( ItalcVncConnection *vncConn ):
 		connect( m_vncConn, SIGNAL( newClient( rfbClient * ) ),
 				this, SLOT( initNewClient( rfbClient * ) ),
 				Qt::DirectConnection );
+		// settings of server are per connection so restore them after
+		// reconnecting
+		connect( m_vncConn, SIGNAL( connected() ),
+				this, SLOT( restoreConnectionSettings() ),
+				Qt::QueuedConnection );
 	}
 }
 
@@ -98,6 +147,29 @@ ItalcCoreConnection::~ItalcCoreConnection()
 void ItalcCoreConnection::initNewClient( rfbClient *cl )
 {
 	rfbClientSetClientData( cl, ItalcCoreConnectionTag, this );
+
+	// server might have been replaced in the meantime
+	m_framedMessages = false;
+	m_receivesNotifications = false;
+
+	// we're able to handle answers to verification requests now
+	m_vncConn->enableFramebufferVerification();
+}
+
+
+
+
+void ItalcCoreConnection::restoreConnectionSettings()
+{
+	if( m_thumbnailSize.isValid() )
+	{
+		enqueueMessage( ItalcCore::Msg( ItalcCore::SetThumbnailSize ).
+							addArg( "width", m_thumbnailSize.width() ).
+							addArg( "height", m_thumbnailSize.height() ) );
+	}
+
+	// servers supporting it answer and push current state right away
+	enqueueMessage( ItalcCore::Msg( ItalcCore::SubscribeNotifications ) );
 }
 
 
@@ -130,24 +202,46 @@ bool ItalcCoreConnection::handleServerMessage( rfbClient *cl, uint8_t msg )
 		qDebug() << "ItalcCoreConnection: received message" << m.cmd()
 					<< "with arguments" << m.args();
 
-		if( m.cmd() == ItalcCore::UserInformation )
+		if( m.isFramed() )
 		{
-			m_user = m.arg( "username" );
-			m_userHomeDir = m.arg( "homedir" );
-			emit receivedUserInfo( m_user, m_userHomeDir );
+			m_framedMessages = true;
 		}
-		else if( m.cmd() == ItalcCore::ReportSlaveStateFlags )
+
+		switch( m.cmdId() )
 		{
-			m_slaveStateFlags = m.arg( "slavestateflags" ).toInt();
-			emit receivedSlaveStateFlags( m_slaveStateFlags );
+			case ItalcCore::UserInformationId:
+				m_user = m.arg( "username" );
+				m_userHomeDir = m.arg( "homedir" );
+				emit receivedUserInfo( m_user, m_userHomeDir );
+				break;
+			case ItalcCore::ReportSlaveStateFlagsId:
+				m_slaveStateFlags = m.arg( "slavestateflags" ).toInt();
+				emit receivedSlaveStateFlags( m_slaveStateFlags );
+				break;
+			case ItalcCore::VerifyFramebufferId:
+				m_vncConn->framebufferVerified(
+									m.arg( "differingtiles" ).toInt() );
+				break;
+			case ItalcCore::AcknowledgeId:
+				break;
+			case ItalcCore::SubscribeNotificationsId:
+				m_receivesNotifications = true;
+				break;
+			// TODO: plugin hook
+			default:
+				qCritical() << "ItalcCoreConnection::"
+					"handleServerMessage(): unknown server "
+					"response" << m.cmd();
+				return false;
 		}
-		// TODO: plugin hook
-		else
+
+		// notifications pushed by server do not carry a request ID
+		const QString requestId = m.arg( "requestid" );
+		if( !requestId.isEmpty() )
 		{
-			qCritical() << "ItalcCoreConnection::"
-				"handleServerMessage(): unknown server "
-				"response" << m.cmd();
-			return false;
+			QElapsedTimer now;
+			now.start();
+			emit acknowledged( requestId.toInt(), now.msecsSinceReference() );
 		}
 	}
 	else
@@ -164,27 +258,27 @@ bool ItalcCoreConnection::handleServerMessage( rfbClient *cl, uint8_t msg )
 
 
 
-void ItalcCoreConnection::sendGetUserInformationRequest()
+int ItalcCoreConnection::sendGetUserInformationRequest()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::GetUserInformation ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::GetUserInformation ) );
 }
 
 
 
 
-void ItalcCoreConnection::execCmds( const QString &cmd )
+int ItalcCoreConnection::execCmds( const QString &cmd )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::ExecCmds ).
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::ExecCmds ).
 						addArg( "cmds", cmd ) );
 }
 
 
 
 
-void ItalcCoreConnection::startDemo( const QString &host, int port,
+int ItalcCoreConnection::startDemo( const QString &host, int port,
 										bool fullscreen )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::StartDemo ).
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::StartDemo ).
 					addArg( "host", host ).
 					addArg( "port", port ).
 					addArg( "fullscreen", fullscreen ) );
@@ -193,41 +287,41 @@ void ItalcCoreConnection::startDemo( const QString &host, int port,
 
 
 
-void ItalcCoreConnection::stopDemo()
+int ItalcCoreConnection::stopDemo()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::StopDemo ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::StopDemo ) );
 }
 
 
 
 
-void ItalcCoreConnection::lockScreen()
+int ItalcCoreConnection::lockScreen()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::LockScreen ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::LockScreen ) );
 }
 
 
 
 
-void ItalcCoreConnection::unlockScreen()
+int ItalcCoreConnection::unlockScreen()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::UnlockScreen ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::UnlockScreen ) );
 }
 
 
 
 
-void ItalcCoreConnection::lockInput()
+int ItalcCoreConnection::lockInput()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::LockInput ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::LockInput ) );
 }
 
 
 
 
-void ItalcCoreConnection::unlockInput()
+int ItalcCoreConnection::unlockInput()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::UnlockInput ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::UnlockInput ) );
 }
 
 
@@ -246,17 +340,17 @@ void ItalcCoreConnection::logonUser( const QString &uname,
 
 
 
-void ItalcCoreConnection::logoutUser()
+int ItalcCoreConnection::logoutUser()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::LogoutUser ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::LogoutUser ) );
 }
 
 
 
 
-void ItalcCoreConnection::displayTextMessage( const QString& title, const QString &msg )
+int ItalcCoreConnection::displayTextMessage( const QString& title, const QString &msg )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::DisplayTextMessage ).
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::DisplayTextMessage ).
 						addArg( "title", title ).
 						addArg( "text", msg ) );
 }
@@ -264,52 +358,52 @@ void ItalcCoreConnection::displayTextMessage( const QString& title, const QStrin
 
 
 
-void ItalcCoreConnection::powerOnComputer( const QString &mac )
+int ItalcCoreConnection::powerOnComputer( const QString &mac )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::PowerOnComputer ).
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::PowerOnComputer ).
 						addArg( "mac",mac ) );
 }
 
 
 
 
-void ItalcCoreConnection::powerDownComputer()
+int ItalcCoreConnection::powerDownComputer()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::PowerDownComputer ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::PowerDownComputer ) );
 }
 
 
 
 
-void ItalcCoreConnection::restartComputer()
+int ItalcCoreConnection::restartComputer()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::RestartComputer ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::RestartComputer ) );
 }
 
 
 
 
-void ItalcCoreConnection::disableLocalInputs( bool disabled )
+int ItalcCoreConnection::disableLocalInputs( bool disabled )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::DisableLocalInputs ).
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::DisableLocalInputs ).
 					addArg( "disabled", disabled ) );
 }
 
 
 
 
-void ItalcCoreConnection::setRole( const ItalcCore::UserRole role )
+int ItalcCoreConnection::setRole( const ItalcCore::UserRole role )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::SetRole ).
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::SetRole ).
 						addArg( "role", role ) );
 }
 
 
 
 
-void ItalcCoreConnection::startDemoServer( int sourcePort, int destinationPort )
+int ItalcCoreConnection::startDemoServer( int sourcePort, int destinationPort )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::StartDemoServer ).
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::StartDemoServer ).
 						addArg( "sourceport", sourcePort ).
 						addArg( "destinationport", destinationPort ) );
 }
@@ -317,48 +411,116 @@ void ItalcCoreConnection::startDemoServer( int sourcePort, int destinationPort )
 
 
 
-void ItalcCoreConnection::stopDemoServer()
+int ItalcCoreConnection::stopDemoServer()
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::StopDemoServer ) );
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::StopDemoServer ) );
 }
 
 
 
 
-void ItalcCoreConnection::demoServerAllowHost( const QString &host )
+int ItalcCoreConnection::demoServerAllowHost( const QString &host )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::DemoServerAllowHost ).
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::DemoServerAllowHost ).
 						addArg( "host", host ) );
 }
 
 
 
 
-void ItalcCoreConnection::demoServerUnallowHost( const QString &host )
+int ItalcCoreConnection::demoServerUnallowHost( const QString &host )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::DemoServerUnallowHost ).
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::DemoServerUnallowHost ).
 						addArg( "host", host ) );
 }
 
 
 
 
-void ItalcCoreConnection::reportSlaveStateFlags()
+int ItalcCoreConnection::reportSlaveStateFlags()
+{
+	return enqueueMessage( ItalcCore::Msg( ItalcCore::ReportSlaveStateFlags ) );
+}
+
+
+
+void ItalcCoreConnection::setThumbnailSize( const QSize &size )
 {
-	enqueueMessage( ItalcCore::Msg( ItalcCore::ReportSlaveStateFlags ) );
+	if( size == m_thumbnailSize )
+	{
+		return;
+	}
+
+	m_thumbnailSize = size;
+
+	// servers not supporting this command just keep sending the
+	// framebuffer in full resolution
+	enqueueMessage( ItalcCore::Msg( ItalcCore::SetThumbnailSize ).
+						addArg( "width", size.width() ).
+						addArg( "height", size.height() ) );
+}
+
+
+
+ItalcCoreBroadcast *ItalcCoreConnection::broadcast(
+							const QVector<ItalcCoreConnection *> &connections,
+							const ItalcCore::Msg &msg )
+{
+	const int requestId = nextRequestId();
+
+	ItalcCore::Msg m( msg );
+	m.addArg( "requestid", requestId );
+
+	// the connections decide on their own which format their server is able
+	// to handle
+	const QByteArray framedData = ItalcCore::Msg( m ).setFramed( true ).encode();
+	const QByteArray unframedData = ItalcCore::Msg( m ).announceFraming().encode();
+
+	ItalcCoreBroadcast *b = new ItalcCoreBroadcast( m.cmd(), requestId );
+
+	for( ItalcCoreConnection *c : connections )
+	{
+		// events for disconnected servers would be dropped anyway
+		if( c->m_vncConn == NULL || c->isConnected() == false )
+		{
+			continue;
+		}
+
+		b->addConnection( c );
+		c->m_vncConn->enqueueEvent(
+						new ItalcMessageEvent( m, framedData, unframedData ) );
+	}
+
+	b->start();
+
+	return b;
 }
 
 
 
-void ItalcCoreConnection::enqueueMessage( const ItalcCore::Msg &msg )
+
+int ItalcCoreConnection::enqueueMessage( const ItalcCore::Msg &msg )
 {
+	const int requestId = nextRequestId();
+
 	ItalcCore::Msg m( msg );
+	m.addArg( "requestid", requestId );
 	if (!m_vncConn)
 	{
 		ilog(Error, "ItalcCoreConnection: cannot call enqueueEvent - m_vncConn is NULL");
-		return;
+		return requestId;
 	}
 	m_vncConn->enqueueEvent( new ItalcMessageEvent( m ) );
+
+	return requestId;
+}
+
+
+
+
+int ItalcCoreConnection::nextRequestId()
+{
+	return __requestIdCounter.fetchAndAddRelaxed( 1 ) + 1;
 }
 
 
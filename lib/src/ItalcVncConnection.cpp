@@ -27,14 +27,22 @@
 
 #include "AuthenticationCredentials.h"
 #include "DsaKey.h"
+#include "FramebufferTileHashes.h"
 #include "ItalcConfiguration.h"
 #include "ItalcVncConnection.h"
+#include "ItalcVncConnectionPool.h"
 #include "LocalSystem.h"
 #include "Logger.h"
 #include "SocketDevice.h"
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
 #include <QtCore/QMutexLocker>
+#if QT_VERSION >= 0x050a00
+#include <QtCore/QRandomGenerator>
+#else
+#include <QtCore/QThreadStorage>
+#endif
 #include <QtCore/QTime>
 #include <QtCore/QTimer>
 
@@ -81,6 +89,12 @@ public:
 		SendPointerEvent( cl, m_x, m_y, m_buttonMask );
 	}
 
+	void move( int x, int y )
+	{
+		m_x = x;
+		m_y = y;
+	}
+
 private:
 	int m_x;
 	int m_y;
@@ -122,6 +136,13 @@ rfbBool ItalcVncConnection::hookNewClient( rfbClient *cl )
 
 	memset( cl->frameBuffer, '\0', size );
 
+	// a resized framebuffer (e.g. due to server-side scaling) is not valid
+	// until the next update with pixel data has been received
+	t->m_framebufferInitialized = false;
+	t->m_framebufferDataReceived = false;
+	t->m_lossyTiles = QBitArray( FramebufferTileHashes::tileCount(
+												cl->width, cl->height ) );
+
 	// initialize framebuffer image which just wraps the allocated memory and ensures cleanup after last
 	// image copy using the framebuffer gets destroyed
 	t->m_imgLock.lockForWrite();
@@ -205,6 +226,12 @@ void ItalcVncConnection::hookUpdateFB( rfbClient *cl, int x, int y, int w, int h
 		}
 	}
 
+	t->m_framebufferDataReceived = true;
+
+	t->updateLossyTiles( QRect( x, y, w, h ), cl->lastRectLossy );
+
+	t->m_damage.add( QRect( x, y, w, h ) );
+
 	t->imageUpdated( x, y, w, h );
 }
 
@@ -327,18 +354,38 @@ void ItalcVncConnection::framebufferCleanup( void *framebuffer )
 ItalcVncConnection::ItalcVncConnection( QObject *parent ) :
 	QThread( parent ),
 	m_framebufferInitialized( false ),
+	m_framebufferDataReceived( false ),
 	m_cl( NULL ),
 	m_italcAuthType( ItalcAuthDSA ),
 	m_quality( DemoClientQuality ),
 	m_port( PortOffsetVncServer ),
 	m_terminateTimer( this ),
 	m_framebufferUpdateInterval( 0 ),
+	m_updatePriority( NormalUpdatePriority ),
 	m_lastFullUpdate(),
+	m_fullUpdateBackoff( 1 ),
+	m_fullUpdateJitter( 0 ),
+	m_updatesSinceFullUpdate( 0 ),
+	m_lastChange(),
+	m_framebufferVerificationEnabled( false ),
+	m_framebufferVerification( VerificationUntested ),
+	m_framebufferVerificationPending( false ),
+	m_lossyTiles(),
+	m_pendingPointerEvent( NULL ),
+	m_pointerButtonMask( 0 ),
 	m_image(),
+	m_damage(),
+	m_nativeFramebufferSize(),
 	m_scaledScreenNeedsUpdate( false ),
 	m_scaledScreen(),
+	m_scaledScreenDamagePosition( 0 ),
 	m_scaledSize(),
-	m_state( Disconnected )
+	m_state( Disconnected ),
+	m_paused( false ),
+	m_updatesPaused( false ),
+	m_sessionTicket(),
+	m_attachedToPool( false ),
+	m_deleteAfterDetach( false )
 {
 	m_terminateTimer.setSingleShot( true );
 	m_terminateTimer.setInterval( ThreadTerminationTimeout );
@@ -353,6 +400,13 @@ ItalcVncConnection::ItalcVncConnection( QObject *parent ) :
 
 ItalcVncConnection::~ItalcVncConnection()
 {
+	if( m_attachedToPool )
+	{
+		// we must not be referenced by any I/O thread once we're gone
+		m_deleteAfterDetach = false;
+		ItalcVncConnectionPool::instance()->remove( this, true );
+	}
+
 	stop();
 
 	if( isRunning() )
@@ -375,7 +429,18 @@ ItalcVncConnection::~ItalcVncConnection()
 
 void ItalcVncConnection::stop( bool deleteAfterFinished )
 {
-	if( isRunning() )
+	m_paused = false;
+
+	if( m_attachedToPool )
+	{
+		m_deleteAfterDetach = deleteAfterFinished;
+
+		m_scaledScreen.clear();
+
+		// connection is closed by its I/O thread in background
+		ItalcVncConnectionPool::instance()->remove( this );
+	}
+	else if( isRunning() )
 	{
 		if( deleteAfterFinished )
 		{
@@ -383,7 +448,7 @@ void ItalcVncConnection::stop( bool deleteAfterFinished )
 					 this, &ItalcVncConnection::deleteLater );
 		}
 
-		m_scaledScreen = QImage();
+		m_scaledScreen.clear();
 
 		requestInterruption();
 
@@ -405,9 +470,47 @@ void ItalcVncConnection::stop( bool deleteAfterFinished )
 
 
 
+void ItalcVncConnection::pause()
+{
+	if( m_attachedToPool == false )
+	{
+		stop();
+		return;
+	}
+
+	if( m_paused == false )
+	{
+		m_paused = true;
+
+		// only keep the most recently paused connections
+		ItalcVncConnection *evicted =
+							ItalcVncConnectionPool::instance()->pause( this );
+		if( evicted )
+		{
+			evicted->stop();
+		}
+	}
+}
+
+
+
+
+void ItalcVncConnection::resume()
+{
+	if( m_paused )
+	{
+		m_paused = false;
+
+		ItalcVncConnectionPool::instance()->resume( this );
+	}
+}
+
+
+
+
 void ItalcVncConnection::reset( const QString &host )
 {
-	if( m_state != Connected && isRunning() )
+	if( m_state != Connected && isActive() )
 	{
 		setHost( host );
 	}
@@ -415,6 +518,21 @@ void ItalcVncConnection::reset( const QString &host )
 	{
 		stop();
 		setHost( host );
+		startConnection();
+	}
+}
+
+
+
+
+void ItalcVncConnection::startConnection()
+{
+	if( isPooled() )
+	{
+		ItalcVncConnectionPool::instance()->add( this );
+	}
+	else
+	{
 		start();
 	}
 }
@@ -497,7 +615,11 @@ void ItalcVncConnection::rescaleScreen()
 	}
 
 	QReadLocker locker( &m_imgLock );
-	m_scaledScreen = m_image.scaled( m_scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+
+	// only re-sample what changed since last time
+	const QRegion damage =
+			m_damage.take( &m_scaledScreenDamagePosition, m_image.rect() );
+	m_scaledScreen.update( m_image, m_scaledSize, damage );
 
 	m_scaledScreenNeedsUpdate = false;
 }
@@ -527,176 +649,405 @@ void ItalcVncConnection::doConnection()
 {
 	QMutex sleeperMutex;
 
-	m_state = Connecting;
+	// try to connect as long as the server allows
+	while( isInterruptionRequested() == false && connectToServer() == false )
+	{
+		// do not sleep when already requested to stop
+		if( isInterruptionRequested() )
+		{
+			break;
+		}
 
-	m_framebufferInitialized = false;
+		// wait a bit until next connect
+		sleeperMutex.lock();
+		m_updateIntervalSleeper.wait( &sleeperMutex, reconnectInterval() );
+		sleeperMutex.unlock();
+	}
 
-	while( isInterruptionRequested() == false && m_state != Connected ) // try to connect as long as the server allows
+	// Main VNC event loop
+	while( isInterruptionRequested() == false )
 	{
-		m_cl = rfbGetClient( 8, 3, 4 );
-		m_cl->MallocFrameBuffer = hookNewClient;
-		m_cl->canHandleNewFBSize = true;
-		m_cl->GotFrameBufferUpdate = hookUpdateFB;
-		m_cl->FinishedFrameBufferUpdate = hookFinishFrameBufferUpdate;
-		m_cl->HandleCursorPos = hookHandleCursorPos;
-		m_cl->GotCursorShape = hookCursorShape;
-		m_cl->GotXCutText = hookCutText;
-		rfbClientSetClientData( m_cl, 0, this );
-
-		m_mutex.lock();
+		sendFramebufferUpdateRequests();
 
-		if( m_port < 0 ) // port is invalid or empty...
+		int timeout = 500;
+		if( m_framebufferUpdateInterval < 0 )
+		{
+			timeout = 100*1000;	// 100 ms
+		}
+		const int i = WaitForMessage( m_cl, timeout );
+		if( isInterruptionRequested() || i < 0 )
+		{
+			break;
+		}
+		else if( i && handleServerMessages() == false )
 		{
-			m_port = PortOffsetVncServer;
+			break;
 		}
 
-		if( m_port >= 0 && m_port < 100 )
+		fireClientEvents();
+
+		if( m_framebufferUpdateInterval > 0 && isInterruptionRequested() == false )
 		{
-			 // the user most likely used the short form (e.g. :1)
-			m_port += PortOffsetVncServer;
+			// events are enqueued with m_mutex locked so we can't miss
+			// being woken up by them
+			m_mutex.lock();
+			if( m_eventQueue.isEmpty() )
+			{
+				m_updateIntervalSleeper.wait( &m_mutex,
+												m_framebufferUpdateInterval );
+			}
+			m_mutex.unlock();
+
+			// send events which woke us up right away
+			fireClientEvents();
 		}
+	}
 
-		free( m_cl->serverHost );
-		m_cl->serverHost = strdup( m_host.toUtf8().constData() );
-		m_cl->serverPort = m_port;
+	closeConnection();
+}
 
-		m_mutex.unlock();
 
-		emit newClient( m_cl );
 
-		int argc = 0;
-		if( rfbInitClient( m_cl, &argc, NULL ) )
-		{
-			emit connected();
+bool ItalcVncConnection::connectToServer()
+{
+	m_state = Connecting;
 
-			m_state = Connected;
-			emit stateChanged( m_state );
-			if( m_framebufferUpdateInterval < 0 )
-			{
-				rfbClientSetClientData( m_cl, (void *) 0x555, (void *) 1 );
-			}
+	m_framebufferInitialized = false;
+
+	m_cl = rfbGetClient( 8, 3, 4 );
+	m_cl->MallocFrameBuffer = hookNewClient;
+	m_cl->canHandleNewFBSize = true;
+	m_cl->GotFrameBufferUpdate = hookUpdateFB;
+	m_cl->FinishedFrameBufferUpdate = hookFinishFrameBufferUpdate;
+	m_cl->HandleCursorPos = hookHandleCursorPos;
+	m_cl->GotCursorShape = hookCursorShape;
+	m_cl->GotXCutText = hookCutText;
+	m_cl->readTimeout = m_attachedToPool ? PooledReadTimeout : 0;
+	rfbClientSetClientData( m_cl, 0, this );
+
+	m_mutex.lock();
+
+	if( m_port < 0 ) // port is invalid or empty...
+	{
+		m_port = PortOffsetVncServer;
+	}
+
+	if( m_port >= 0 && m_port < 100 )
+	{
+		 // the user most likely used the short form (e.g. :1)
+		m_port += PortOffsetVncServer;
+	}
+
+	free( m_cl->serverHost );
+	m_cl->serverHost = strdup( m_host.toUtf8().constData() );
+	m_cl->serverPort = m_port;
+
+	m_mutex.unlock();
+
+	emit newClient( m_cl );
+
+	int argc = 0;
+	if( rfbInitClient( m_cl, &argc, NULL ) )
+	{
+		m_nativeFramebufferSize = QSize( m_cl->si.framebufferWidth,
+											m_cl->si.framebufferHeight );
+
+		// set state before emitting connected() so receivers can enqueue
+		// events right away
+		m_state = Connected;
+
+		emit connected();
+
+		emit stateChanged( m_state );
+		if( m_framebufferUpdateInterval < 0 )
+		{
+			rfbClientSetClientData( m_cl, (void *) 0x555, (void *) 1 );
 		}
-		else
+		m_updatesPaused = false;
+
+		m_fullUpdateBackoff = 1;
+		scheduleFullUpdate();
+
+		// server might have been updated in the meantime
+		m_framebufferVerification = VerificationUntested;
+		m_framebufferVerificationPending = false;
+
+		return true;
+	}
+
+	// guess reason why connection failed based on the state,
+	// libvncclient left the rfbClient structure
+	if( argc < 0 )
+	{
+		m_state = HostUnreachable;
+		emit stateChanged( m_state );
+	}
+	else if( argc > 0 )
+	{
+		m_state = AuthenticationFailed;
+		emit stateChanged( m_state );
+	}
+	else
+	{
+		// failed for an unknown reason
+		m_state = ConnectionFailed;
+		emit stateChanged( m_state );
+	}
+
+	return false;
+}
+
+
+
+int ItalcVncConnection::reconnectInterval() const
+{
+	if( m_framebufferUpdateInterval > 0 )
+	{
+		return m_framebufferUpdateInterval;
+	}
+
+	// default: retry every second
+	return 1000;
+}
+
+
+
+bool ItalcVncConnection::handleServerMessages()
+{
+	// handle all available messages including the ones libvncclient
+	// already read into its buffer
+	do
+	{
+		if( !HandleRFBServerMessage( m_cl ) )
 		{
-			// guess reason why connection failed based on the state,
-			// libvncclient left the rfbClient structure
-			if( argc < 0 )
-			{
-				m_state = HostUnreachable;
-				emit stateChanged( m_state );
-			}
-			else if( argc > 0 )
-			{
-				m_state = AuthenticationFailed;
-				emit stateChanged( m_state );
-			}
-			else
-			{
-				// failed for an unknown reason
-				m_state = ConnectionFailed;
-				emit stateChanged( m_state );
-			}
+			return false;
+		}
+	} while( m_cl->buffered > 0 || WaitForMessage( m_cl, 0 ) > 0 );
 
-			// do not sleep when already requested to stop
-			if( isInterruptionRequested() )
-			{
-				break;
-			}
+	return true;
+}
 
-			// wait a bit until next connect
-			sleeperMutex.lock();
-			if( m_framebufferUpdateInterval > 0 )
-			{
-				m_updateIntervalSleeper.wait( &sleeperMutex,
-												m_framebufferUpdateInterval );
-			}
-			else
-			{
-				// default: retry every second
-				m_updateIntervalSleeper.wait( &sleeperMutex, 1000 );
-			}
-			sleeperMutex.unlock();
+
+
+void ItalcVncConnection::sendFramebufferUpdateRequests()
+{
+	if( m_paused != m_updatesPaused )
+	{
+		m_updatesPaused = m_paused;
+
+		// keeps libvncclient from requesting further updates on its own
+		rfbClientSetClientData( m_cl, (void *) 0x555,
+				m_updatesPaused || m_framebufferUpdateInterval < 0 ?
+												(void *) 1 : NULL );
+
+		// server kept track of all changes while we were paused
+		if( m_updatesPaused == false && m_framebufferInitialized )
+		{
+			SendFramebufferUpdateRequest( m_cl, 0, 0,
+									framebufferSize().width(),
+									framebufferSize().height(),
+									true );
 		}
 	}
 
-	m_lastFullUpdate.restart();
+	if( m_updatesPaused )
+	{
+		return;
+	}
 
-	// Main VNC event loop
-	while( isInterruptionRequested() == false )
+	if( m_framebufferInitialized == false )
+	{
+		// request initial full framebuffer update
+		SendFramebufferUpdateRequest( m_cl, 0, 0,
+				framebufferSize().width(), framebufferSize().height(),
+				false );
+	}
+
+	// ensure that we're not missing updates due to slow update rate therefore
+	// regularly verify framebuffer or request full updates if server does not
+	// support verification - pooled connections share a global budget for them
+	if( isFullUpdateDue() &&
+			( m_attachedToPool == false ||
+				ItalcVncConnectionPool::instance()->acquireFullUpdate( this ) ) )
 	{
-		if( m_framebufferInitialized == false )
+		if( sendFramebufferVerification() == false )
 		{
-			// request initial full framebuffer update
 			SendFramebufferUpdateRequest( m_cl, 0, 0,
-					framebufferSize().width(), framebufferSize().height(),
-					false );
+									framebufferSize().width(),
+									framebufferSize().height(),
+									false );
 		}
 
-		int timeout = 500;
-		if( m_framebufferUpdateInterval < 0 )
+		// nothing changed except for the answer to previous full update
+		if( m_updatesSinceFullUpdate <= 1 )
 		{
-			timeout = 100*1000;	// 100 ms
+			m_fullUpdateBackoff = qMin<int>( m_fullUpdateBackoff * 2,
+												MaxFullUpdateBackoff );
 		}
-		const int i = WaitForMessage( m_cl, timeout );
-		if( isInterruptionRequested() || i < 0 )
+		else
 		{
-			break;
+			m_fullUpdateBackoff = 1;
 		}
-		else if( i )
-		{
-			// handle all available messages
-			bool handledOkay = true;
-			do {
-				if( !HandleRFBServerMessage( m_cl ) )
-				{
-					handledOkay = false;
-				}
-			} while( handledOkay && WaitForMessage( m_cl, 0 ) );
 
-			if( handledOkay == false )
+		scheduleFullUpdate();
+	}
+}
+
+
+
+bool ItalcVncConnection::isFullUpdateDue() const
+{
+	return m_framebufferUpdateInterval > 0 &&
+			m_lastFullUpdate.elapsed() > FullUpdateIntervals *
+						m_framebufferUpdateInterval * m_fullUpdateBackoff +
+															m_fullUpdateJitter;
+}
+
+
+
+void ItalcVncConnection::scheduleFullUpdate()
+{
+	// add some randomness so connections established at the same time do
+	// not request their full updates at the same time forever
+	const int maxJitter = qMax( 0, m_framebufferUpdateInterval ) *
+												FullUpdateIntervals / 2 + 1;
+#if QT_VERSION >= 0x050a00
+	m_fullUpdateJitter = QRandomGenerator::global()->bounded( maxJitter );
+#else
+	// qrand() is seeded per thread with 1 by default which would make all
+	// I/O threads of the connection pool generate the same sequence
+	static QThreadStorage<bool> seeded;
+	if( seeded.hasLocalData() == false )
+	{
+		qsrand( QDateTime::currentMSecsSinceEpoch() ^
+					(quintptr) QThread::currentThreadId() );
+		seeded.setLocalData( true );
+	}
+	m_fullUpdateJitter = qrand() % maxJitter;
+#endif
+	m_updatesSinceFullUpdate = 0;
+	m_lastFullUpdate.restart();
+}
+
+
+
+// sends hashes of all tiles of current framebuffer so server only sends the
+// ones which differ - returns false if a full update has to be requested
+bool ItalcVncConnection::sendFramebufferVerification()
+{
+	if( m_framebufferVerificationPending &&
+			m_framebufferVerification == VerificationUntested )
+	{
+		// servers not supporting verification do not answer at all
+		m_framebufferVerification = VerificationUnsupported;
+	}
+
+	if( m_framebufferVerificationEnabled == false ||
+			m_framebufferVerification == VerificationUnsupported ||
+			m_framebufferVerificationPending ||
+			m_framebufferInitialized == false ||
+			m_cl->format.bitsPerPixel != 32 )
+	{
+		return false;
+	}
+
+	const QVector<quint32> hashes = FramebufferTileHashes::hashes(
+							m_image.constBits(), m_image.bytesPerLine(),
+							m_image.width(), m_image.height(),
+							FramebufferTileHashes::colorMask( m_cl->format ) );
+
+	// servers which verified framebuffers before also handle framed messages
+	SocketDevice socketDev( libvncClientDispatcher, m_cl );
+	ItalcCore::Msg( &socketDev, ItalcCore::VerifyFramebuffer ).
+			setFramed( m_framebufferVerification == VerificationSupported ).
+			addArg( "tilesize", FramebufferTileHashes::TileSize ).
+			addArg( "width", m_image.width() ).
+			addArg( "height", m_image.height() ).
+			addArg( "hashes", FramebufferTileHashes::toByteArray( hashes ) ).
+			addArg( "lossytiles", m_lossyTiles ).
+				send();
+
+	m_framebufferVerificationPending = true;
+
+	return true;
+}
+
+
+
+// a lossy rectangle makes all tiles it touches lossy while a lossless one
+// only makes the tiles it covers completely lossless
+void ItalcVncConnection::updateLossyTiles( const QRect &rect, bool lossy )
+{
+	const int tileSize = FramebufferTileHashes::TileSize;
+	const int tilesPerRow = ( m_image.width() + tileSize - 1 ) / tileSize;
+	const QRect r = rect.intersected( m_image.rect() );
+	if( r.isEmpty() ||
+			m_lossyTiles.size() != FramebufferTileHashes::tileCount(
+								m_image.width(), m_image.height() ) )
+	{
+		return;
+	}
+
+	for( int ty = r.top() / tileSize; ty <= r.bottom() / tileSize; ++ty )
+	{
+		for( int tx = r.left() / tileSize; tx <= r.right() / tileSize; ++tx )
+		{
+			const QRect tile = QRect( tx * tileSize, ty * tileSize,
+								tileSize, tileSize ).intersected( m_image.rect() );
+			if( lossy )
 			{
-				break;
+				m_lossyTiles.setBit( ty * tilesPerRow + tx );
+			}
+			else if( r.contains( tile ) )
+			{
+				m_lossyTiles.clearBit( ty * tilesPerRow + tx );
 			}
 		}
+	}
+}
 
-		// ensure that we're not missing updates due to slow update rate therefore
-		// regularly request full updates
-		if( m_framebufferUpdateInterval > 0 &&
-					m_lastFullUpdate.elapsed() > 10*m_framebufferUpdateInterval )
-		{
-			SendFramebufferUpdateRequest( m_cl, 0, 0,
-										  framebufferSize().width(), framebufferSize().height(),
-										  false );
-			m_lastFullUpdate.restart();
-		}
 
-		m_mutex.lock();
 
-		while( !m_eventQueue.isEmpty() )
-		{
-			ClientEvent * clientEvent = m_eventQueue.dequeue();
+void ItalcVncConnection::framebufferVerified( int differingTiles )
+{
+	// differing tiles are sent with one of the next updates
+	Q_UNUSED( differingTiles );
 
-			// unlock the queue mutex during the runtime of ClientEvent::fire()
-			m_mutex.unlock();
+	m_framebufferVerification = VerificationSupported;
+	m_framebufferVerificationPending = false;
+}
 
-			clientEvent->fire( m_cl );
-			delete clientEvent;
 
-			// and lock it again
-			m_mutex.lock();
-		}
 
-		m_mutex.unlock();
+void ItalcVncConnection::fireClientEvents()
+{
+	m_mutex.lock();
 
-		if( m_framebufferUpdateInterval > 0 && isInterruptionRequested() == false )
+	while( !m_eventQueue.isEmpty() )
+	{
+		ClientEvent * clientEvent = m_eventQueue.dequeue();
+		if( clientEvent == m_pendingPointerEvent )
 		{
-			sleeperMutex.lock();
-			m_updateIntervalSleeper.wait( &sleeperMutex,
-												m_framebufferUpdateInterval );
-			sleeperMutex.unlock();
+			m_pendingPointerEvent = NULL;
 		}
+
+		// unlock the queue mutex during the runtime of ClientEvent::fire()
+		m_mutex.unlock();
+
+		clientEvent->fire( m_cl );
+		delete clientEvent;
+
+		// and lock it again
+		m_mutex.lock();
 	}
 
+	m_mutex.unlock();
+}
+
+
+
+void ItalcVncConnection::closeConnection()
+{
 	if( m_state == Connected && m_cl )
 	{
 		rfbClientCleanup( m_cl );
@@ -709,15 +1060,42 @@ void ItalcVncConnection::doConnection()
 
 
 
+void ItalcVncConnection::detachedFromPool()
+{
+	// called with pool's mutex locked
+	m_attachedToPool = false;
+
+	if( m_deleteAfterDetach )
+	{
+		deleteLater();
+	}
+}
+
+
+
 void ItalcVncConnection::finishFrameBufferUpdate()
 {
 	if( m_framebufferInitialized == false )
 	{
+		// update only announced a new framebuffer size
+		if( m_framebufferDataReceived == false )
+		{
+			return;
+		}
+
 		m_framebufferInitialized = true;
 
 		emit framebufferSizeChanged( m_image.width(), m_image.height() );
 	}
 
+	// first update after a full update request usually is its answer
+	if( m_updatesSinceFullUpdate > 0 )
+	{
+		m_lastChange.restart();
+	}
+
+	++m_updatesSinceFullUpdate;
+
 	emit framebufferUpdateComplete();
 
 	m_scaledScreenNeedsUpdate = true;
@@ -731,10 +1109,14 @@ void ItalcVncConnection::enqueueEvent( ClientEvent *e )
 	QMutexLocker lock( &m_mutex );
 	if( m_state != Connected )
 	{
+		delete e;
 		return;
 	}
 
+	// moves following e must not be merged into pointer events before it
+	m_pendingPointerEvent = NULL;
 	m_eventQueue.enqueue( e );
+	m_updateIntervalSleeper.wakeAll();
 }
 
 
@@ -742,7 +1124,28 @@ void ItalcVncConnection::enqueueEvent( ClientEvent *e )
 
 void ItalcVncConnection::mouseEvent( int x, int y, int buttonMask )
 {
-	enqueueEvent( new PointerClientEvent( x, y, buttonMask ) );
+	QMutexLocker lock( &m_mutex );
+	if( m_state != Connected )
+	{
+		return;
+	}
+
+	// only the latest position of moves which have not been sent yet
+	// matters - events changing buttons are never merged so presses and
+	// releases happen where they happened locally
+	const bool buttonsChanged = buttonMask != m_pointerButtonMask;
+	m_pointerButtonMask = buttonMask;
+
+	if( buttonsChanged == false && m_pendingPointerEvent )
+	{
+		m_pendingPointerEvent->move( x, y );
+		return;
+	}
+
+	PointerClientEvent *e = new PointerClientEvent( x, y, buttonMask );
+	m_eventQueue.enqueue( e );
+	m_pendingPointerEvent = buttonsChanged ? NULL : e;
+	m_updateIntervalSleeper.wakeAll();
 }
 
 
@@ -791,6 +1194,15 @@ void ItalcVncConnection::handleSecTypeItalc( rfbClient *client )
 					chosenAuthType = v.toInt();
 				}
 			}
+
+			// let server skip signature verification when reconnecting
+			if( chosenAuthType == ItalcAuthDSA &&
+					supportedAuthTypes.values().contains( ItalcAuthTicket ) &&
+					ItalcCore::authenticationCredentials->hasCredentials(
+										AuthenticationCredentials::PrivateKey ) )
+			{
+				chosenAuthType = ItalcAuthTicket;
+			}
 		}
 	}
 
@@ -817,6 +1229,25 @@ void ItalcVncConnection::handleSecTypeItalc( rfbClient *client )
 													privateKey()->sign( chall ) );
 		}
 	}
+	else if( chosenAuthType == ItalcAuthTicket )
+	{
+		ItalcVncConnection *t = (ItalcVncConnection *)
+										rfbClientGetClientData( client, 0 );
+
+		// tickets are only accepted for the role they have been issued for
+		socketDev.write( QVariant( t->m_sessionTicket ) );
+		socketDev.write( QVariant( (int) ItalcCore::role ) );
+		if( socketDev.read().toBool() == false )
+		{
+			QByteArray chall = socketDev.read().toByteArray();
+			socketDev.write( QVariant( (int) ItalcCore::role ) );
+			socketDev.write( ItalcCore::authenticationCredentials->
+													privateKey()->sign( chall ) );
+		}
+
+		// ticket for next connection attempt
+		t->m_sessionTicket = socketDev.read().toByteArray();
+	}
 	else if( chosenAuthType == ItalcAuthHostBased )
 	{
 		// nothing to do - we just get accepted if our IP is in the list of
@@ -0,0 +1,581 @@
+/*
+ * ItalcVncConnectionPool.cpp - implementation of ItalcVncConnectionPool class
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <italcconfig.h>
+
+#ifdef ITALC_BUILD_WIN32
+#include <winsock2.h>
+#else
+#include <poll.h>
+#endif
+
+#include <QtCore/QRunnable>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+
+#include "ItalcVncConnection.h"
+#include "ItalcVncConnectionPool.h"
+
+
+// state of a connection inside the pool - all fields are protected by the
+// pool's mutex
+struct PooledConnection
+{
+	enum States
+	{
+		Idle,			// waiting for next connection attempt
+		Connecting,		// ItalcVncConnectTask is running
+		Connected
+	} ;
+
+	PooledConnection( ItalcVncConnection *c ) :
+		connection( c ),
+		state( Idle ),
+		nextService( 0 ),
+		removeRequested( false ),
+		reconnectRequested( false )
+	{
+	}
+
+	ItalcVncConnection *connection;
+	States state;
+	// time of pool clock when to try to connect again or to handle
+	// messages next time
+	qint64 nextService;
+	bool removeRequested;
+	bool reconnectRequested;
+} ;
+
+
+
+// performs blocking connection setup in pool's connect thread pool
+class ItalcVncConnectTask : public QRunnable
+{
+public:
+	ItalcVncConnectTask( ItalcVncConnectionPool *pool, PooledConnection *c ) :
+		QRunnable(),
+		m_pool( pool ),
+		m_connection( c )
+	{
+		setAutoDelete( true );
+	}
+
+	virtual void run()
+	{
+		ItalcVncConnection *c = m_connection->connection;
+		const bool success = c->connectToServer();
+
+		QMutexLocker lock( &m_pool->m_mutex );
+		const qint64 now = m_pool->m_clock.elapsed();
+		if( success )
+		{
+			m_connection->state = PooledConnection::Connected;
+			m_connection->nextService = now;
+		}
+		else
+		{
+			m_connection->state = PooledConnection::Idle;
+			m_connection->nextService = now + c->reconnectInterval();
+		}
+	}
+
+
+private:
+	ItalcVncConnectionPool *m_pool;
+	PooledConnection *m_connection;
+
+} ;
+
+
+
+// waits for messages of all connections assigned to it and processes them
+class ItalcVncIoThread : public QThread
+{
+public:
+	ItalcVncIoThread( ItalcVncConnectionPool *pool ) :
+		QThread(),
+		m_pool( pool ),
+		m_connections()
+	{
+	}
+
+	virtual ~ItalcVncIoThread()
+	{
+		qDeleteAll( m_connections );
+	}
+
+	// following functions have to be called with pool's mutex locked
+	int connectionCount() const
+	{
+		return m_connections.size();
+	}
+
+	void add( ItalcVncConnection *c )
+	{
+		for( PooledConnection *pc : m_connections )
+		{
+			if( pc->connection == c )
+			{
+				// connection got restarted before it has been detached
+				pc->removeRequested = false;
+				pc->reconnectRequested = true;
+				return;
+			}
+		}
+
+		m_connections += new PooledConnection( c );
+	}
+
+	void remove( ItalcVncConnection *c )
+	{
+		for( PooledConnection *pc : m_connections )
+		{
+			if( pc->connection == c )
+			{
+				pc->removeRequested = true;
+			}
+		}
+	}
+
+
+protected:
+	virtual void run();
+
+
+private:
+	void detach( PooledConnection *pc );
+
+	ItalcVncConnectionPool *m_pool;
+	QList<PooledConnection *> m_connections;
+
+} ;
+
+
+
+void ItalcVncIoThread::run()
+{
+	QMutex &mutex = m_pool->m_mutex;
+
+	while( isInterruptionRequested() == false )
+	{
+		mutex.lock();
+		const QList<PooledConnection *> connections = m_connections;
+		mutex.unlock();
+
+		QList<PooledConnection *> readyConnections;
+		QList<PooledConnection *> waitingConnections;
+#ifdef ITALC_BUILD_WIN32
+		// fd_set is a list of sockets on Windows and MaxConnectionsPerThread
+		// keeps it below FD_SETSIZE
+		fd_set fds;
+		FD_ZERO( &fds );
+		int maxFd = -1;
+#else
+		// socket descriptors may exceed FD_SETSIZE when lots of files and
+		// connections are open so we can't use select() here
+		QVector<struct pollfd> fds;
+#endif
+		qint64 waitTime = ItalcVncConnectionPool::MaxWaitTime;
+
+		// entries are only deleted by us so we can work with them without
+		// holding the lock all the time
+		for( PooledConnection *pc : connections )
+		{
+			ItalcVncConnection *c = pc->connection;
+
+			mutex.lock();
+			const qint64 now = m_pool->m_clock.elapsed();
+			PooledConnection::States state = pc->state;
+			const bool removeRequested = pc->removeRequested;
+			const bool reconnectRequested = pc->reconnectRequested;
+			pc->reconnectRequested = false;
+			// paused connections are not re-established before resuming
+			if( state == PooledConnection::Idle && removeRequested == false &&
+					c->isPaused() == false && now >= pc->nextService )
+			{
+				pc->state = state = PooledConnection::Connecting;
+				m_pool->m_connectPool.start( new ItalcVncConnectTask( m_pool, pc ) );
+			}
+			const qint64 nextService = pc->nextService;
+			mutex.unlock();
+
+			if( state == PooledConnection::Connecting )
+			{
+				// removal has to wait until connect task has finished
+				continue;
+			}
+
+			if( removeRequested )
+			{
+				detach( pc );
+				continue;
+			}
+
+			if( state != PooledConnection::Connected )
+			{
+				if( c->isPaused() == false )
+				{
+					waitTime = qMin( waitTime, nextService - now );
+				}
+				continue;
+			}
+
+			if( reconnectRequested )
+			{
+				c->closeConnection();
+
+				QMutexLocker lock( &mutex );
+				pc->state = PooledConnection::Idle;
+				pc->nextService = now;
+				continue;
+			}
+
+			c->fireClientEvents();
+			c->sendFramebufferUpdateRequests();
+
+			// connections with a framebuffer update interval are not
+			// looked at more often so the server has to wait with sending
+			// updates, the same way the connection thread sleeps
+			if( now < nextService )
+			{
+				waitTime = qMin( waitTime, nextService - now );
+			}
+			else if( c->m_cl->buffered > 0 )
+			{
+				readyConnections += pc;
+				waitTime = 0;
+			}
+			else
+			{
+#ifdef ITALC_BUILD_WIN32
+				FD_SET( c->m_cl->sock, &fds );
+				maxFd = qMax( maxFd, c->m_cl->sock );
+#else
+				const struct pollfd pfd = { c->m_cl->sock, POLLIN, 0 } ;
+				fds += pfd;
+#endif
+				waitingConnections += pc;
+			}
+		}
+
+		waitTime = qMax<qint64>( 0, waitTime );
+
+		if( waitingConnections.isEmpty() == false )
+		{
+#ifdef ITALC_BUILD_WIN32
+			struct timeval timeout;
+			timeout.tv_sec = waitTime / 1000;
+			timeout.tv_usec = ( waitTime % 1000 ) * 1000;
+
+			if( select( maxFd + 1, &fds, NULL, NULL, &timeout ) > 0 )
+			{
+				for( PooledConnection *pc : waitingConnections )
+				{
+					if( FD_ISSET( pc->connection->m_cl->sock, &fds ) )
+					{
+						readyConnections += pc;
+					}
+				}
+			}
+#else
+			if( poll( fds.data(), fds.size(), waitTime ) > 0 )
+			{
+				for( int i = 0; i < fds.size(); ++i )
+				{
+					// errors and hangups are detected while reading
+					if( fds[i].revents )
+					{
+						readyConnections += waitingConnections[i];
+					}
+				}
+			}
+#endif
+		}
+		else if( waitTime > 0 )
+		{
+			// select() without any sockets does not sleep on Windows
+			msleep( waitTime );
+		}
+
+		for( PooledConnection *pc : readyConnections )
+		{
+			ItalcVncConnection *c = pc->connection;
+			const bool success = c->handleServerMessages();
+			if( success == false )
+			{
+				c->closeConnection();
+			}
+
+			QMutexLocker lock( &mutex );
+			const qint64 now = m_pool->m_clock.elapsed();
+			if( success )
+			{
+				pc->nextService = now + m_pool->updateInterval( c );
+			}
+			else
+			{
+				// try to reconnect immediately as connection thread does
+				pc->state = PooledConnection::Idle;
+				pc->nextService = now;
+			}
+		}
+	}
+}
+
+
+
+void ItalcVncIoThread::detach( PooledConnection *pc )
+{
+	ItalcVncConnection *c = pc->connection;
+
+	if( pc->state == PooledConnection::Connected )
+	{
+		c->closeConnection();
+	}
+
+	// a waiting destructor of c returns as soon as we release the lock so
+	// c must not be accessed afterwards
+	QMutexLocker lock( &m_pool->m_mutex );
+	m_connections.removeAll( pc );
+	m_pool->m_assignments.remove( c );
+	c->detachedFromPool();
+	m_pool->m_detached.wakeAll();
+
+	delete pc;
+}
+
+
+
+
+ItalcVncConnectionPool *ItalcVncConnectionPool::instance()
+{
+	static ItalcVncConnectionPool pool;
+
+	return &pool;
+}
+
+
+
+
+ItalcVncConnectionPool::ItalcVncConnectionPool() :
+	m_mutex(),
+	m_detached(),
+	m_clock(),
+	m_ioThreads(),
+	m_assignments(),
+	m_pausedConnections(),
+	m_connectPool(),
+	m_fullUpdateTokens( MaxFullUpdatesPerSecond ),
+	m_lastFullUpdateRefill( 0 )
+{
+	m_clock.start();
+	m_connectPool.setMaxThreadCount( MaxConnectThreads );
+}
+
+
+
+
+ItalcVncConnectionPool::~ItalcVncConnectionPool()
+{
+	for( ItalcVncIoThread *t : m_ioThreads )
+	{
+		t->requestInterruption();
+	}
+
+	for( ItalcVncIoThread *t : m_ioThreads )
+	{
+		t->wait();
+	}
+
+	m_connectPool.waitForDone();
+
+	qDeleteAll( m_ioThreads );
+}
+
+
+
+
+void ItalcVncConnectionPool::add( ItalcVncConnection *connection )
+{
+	QMutexLocker lock( &m_mutex );
+
+	ItalcVncIoThread *t = m_assignments.value( connection );
+	if( t == NULL )
+	{
+		t = leastLoadedThread();
+		m_assignments[connection] = t;
+	}
+
+	t->add( connection );
+	m_pausedConnections.removeAll( connection );
+
+	connection->m_attachedToPool = true;
+}
+
+
+
+
+void ItalcVncConnectionPool::remove( ItalcVncConnection *connection, bool wait )
+{
+	QMutexLocker lock( &m_mutex );
+
+	ItalcVncIoThread *t = m_assignments.value( connection );
+	if( t == NULL )
+	{
+		return;
+	}
+
+	t->remove( connection );
+	m_pausedConnections.removeAll( connection );
+
+	while( wait && m_assignments.contains( connection ) )
+	{
+		m_detached.wait( &m_mutex );
+	}
+}
+
+
+
+
+ItalcVncConnection *ItalcVncConnectionPool::pause(
+												ItalcVncConnection *connection )
+{
+	QMutexLocker lock( &m_mutex );
+
+	m_pausedConnections.removeAll( connection );
+	m_pausedConnections += connection;
+
+	if( m_pausedConnections.size() > MaxPausedConnections )
+	{
+		return m_pausedConnections.takeFirst();
+	}
+
+	return NULL;
+}
+
+
+
+
+void ItalcVncConnectionPool::resume( ItalcVncConnection *connection )
+{
+	QMutexLocker lock( &m_mutex );
+
+	m_pausedConnections.removeAll( connection );
+}
+
+
+
+
+bool ItalcVncConnectionPool::acquireFullUpdate(
+										const ItalcVncConnection *connection )
+{
+	QMutexLocker lock( &m_mutex );
+
+	const qint64 now = m_clock.elapsed();
+	m_fullUpdateTokens = qMin<double>( MaxFullUpdatesPerSecond,
+					m_fullUpdateTokens +
+						( now - m_lastFullUpdateRefill ) *
+								MaxFullUpdatesPerSecond / 1000.0 );
+	m_lastFullUpdateRefill = now;
+
+	const double required =
+		connection->updatePriority() == ItalcVncConnection::LowUpdatePriority ?
+										MaxFullUpdatesPerSecond / 2 : 1;
+	if( m_fullUpdateTokens < required )
+	{
+		return false;
+	}
+
+	m_fullUpdateTokens -= 1;
+
+	return true;
+}
+
+
+
+
+qint64 ItalcVncConnectionPool::updateInterval(
+								const ItalcVncConnection *connection ) const
+{
+	qint64 interval = qMax( 0, connection->framebufferUpdateInterval() );
+
+	if( connection->isPaused() )
+	{
+		// only has to handle occasional messages of server
+		return interval * UpdatePriorityFactor;
+	}
+
+	switch( connection->updatePriority() )
+	{
+	case ItalcVncConnection::HighUpdatePriority:
+		// not limited by global budget as there are only few of them
+		return interval / UpdatePriorityFactor;
+	case ItalcVncConnection::LowUpdatePriority:
+		interval *= UpdatePriorityFactor;
+		break;
+	default:
+		if( connection->idleTime() > interval * IdleUpdateIntervals )
+		{
+			interval *= UpdatePriorityFactor;
+		}
+		break;
+	}
+
+	// all other active connections share the global budget
+	return qMax<qint64>( interval,
+					( m_assignments.size() - m_pausedConnections.size() ) *
+											1000 / MaxUpdatesPerSecond );
+}
+
+
+
+
+ItalcVncIoThread *ItalcVncConnectionPool::leastLoadedThread()
+{
+	ItalcVncIoThread *leastLoaded = NULL;
+	for( ItalcVncIoThread *t : m_ioThreads )
+	{
+		if( leastLoaded == NULL ||
+				t->connectionCount() < leastLoaded->connectionCount() )
+		{
+			leastLoaded = t;
+		}
+	}
+
+	// start up to MaxIoThreads threads on demand and more only if the
+	// existing ones are full
+	const int maxIoThreads =
+				qBound<int>( 1, QThread::idealThreadCount(), MaxIoThreads );
+	if( leastLoaded == NULL ||
+			( leastLoaded->connectionCount() > 0 &&
+					m_ioThreads.size() < maxIoThreads ) ||
+			leastLoaded->connectionCount() >= MaxConnectionsPerThread )
+	{
+		leastLoaded = new ItalcVncIoThread( this );
+		leastLoaded->start();
+		m_ioThreads += leastLoaded;
+	}
+
+	return leastLoaded;
+}
@@ -0,0 +1,167 @@
+/*
+ * ScaledFramebuffer.cpp - implementation of ScaledFramebuffer class
+ *
+ * Copyright (c) 2017 Tobias Doerffel <tobydox/at/users/dot/sf/dot/net>
+ *
+ * This file is part of iTALC - http://italc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program (see COPYING); if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <QtCore/QtMath>
+#include <QtGui/QPainter>
+
+#include "FramebufferScaler.h"
+#include "ScaledFramebuffer.h"
+
+
+ScaledFramebuffer::ScaledFramebuffer() :
+	m_image(),
+	m_sourceSize()
+{
+}
+
+
+
+
+QRegion ScaledFramebuffer::update( const QImage &source, const QSize &size,
+									const QRegion &damage )
+{
+	if( source.isNull() || size.isEmpty() )
+	{
+		clear();
+		return QRegion();
+	}
+
+	if( m_image.size() != size || m_sourceSize != source.size() )
+	{
+		return rescale( source, size );
+	}
+
+	if( damage.isEmpty() )
+	{
+		return QRegion();
+	}
+
+	QVector<QRect> rects = damage.rects();
+	if( rects.size() > MaxRects )
+	{
+		rects.clear();
+		rects += damage.boundingRect();
+	}
+
+	const qreal sx = size.width() / (qreal) source.width();
+	const qreal sy = size.height() / (qreal) source.height();
+
+	// map damaged rects to the pixels of scaled image they influence
+	QRegion modified;
+	for( const QRect &r : rects )
+	{
+		const int x0 = qFloor( r.x() * sx ) - Border;
+		const int y0 = qFloor( r.y() * sy ) - Border;
+		const int x1 = qCeil( ( r.x() + r.width() ) * sx ) + Border;
+		const int y1 = qCeil( ( r.y() + r.height() ) * sy ) + Border;
+		modified += QRect( x0, y0, x1 - x0, y1 - y0 ).intersected( m_image.rect() );
+	}
+
+	// re-sampling parts separately only pays off for smaller changes
+	const QRect bounds = modified.boundingRect();
+	if( bounds.width() * bounds.height() * 2 >
+			m_image.width() * m_image.height() )
+	{
+		return rescale( source, size );
+	}
+
+	for( const QRect &r : modified.rects() )
+	{
+		resample( source, r );
+	}
+
+	return modified;
+}
+
+
+
+
+void ScaledFramebuffer::clear()
+{
+	m_image = QImage();
+	m_sourceSize = QSize();
+}
+
+
+
+
+QRegion ScaledFramebuffer::rescale( const QImage &source, const QSize &size )
+{
+	if( FramebufferScaler::canScale( source, size ) )
+	{
+		m_image = FramebufferScaler::scaled( source, size );
+		m_sourceSize = source.size();
+
+		return QRegion( m_image.rect() );
+	}
+
+	m_image = source.scaled( size, Qt::IgnoreAspectRatio,
+								Qt::SmoothTransformation ).
+									convertToFormat( QImage::Format_RGB32 );
+	m_sourceSize = source.size();
+
+	return QRegion( m_image.rect() );
+}
+
+
+
+
+void ScaledFramebuffer::resample( const QImage &source, const QRect &rect )
+{
+	if( FramebufferScaler::canScale( source, m_image.size() ) )
+	{
+		FramebufferScaler::scale( source, &m_image, rect );
+		return;
+	}
+
+	const qreal sx = source.width() / (qreal) m_image.width();
+	const qreal sy = source.height() / (qreal) m_image.height();
+
+	// source pixels contributing to given rect including a border so the
+	// filter sees the same neighbours as when scaling everything
+	const int x0 = qMax( 0, qFloor( rect.x() * sx ) - Border );
+	const int y0 = qMax( 0, qFloor( rect.y() * sy ) - Border );
+	const int x1 = qMin( source.width(),
+						qCeil( ( rect.x() + rect.width() ) * sx ) + Border );
+	const int y1 = qMin( source.height(),
+						qCeil( ( rect.y() + rect.height() ) * sy ) + Border );
+
+	// position of these source pixels in scaled image
+	const int ox = qRound( x0 / sx );
+	const int oy = qRound( y0 / sy );
+	const int ow = qRound( x1 / sx ) - ox;
+	const int oh = qRound( y1 / sy ) - oy;
+	if( ow <= 0 || oh <= 0 )
+	{
+		return;
+	}
+
+	const QImage part = source.copy( x0, y0, x1 - x0, y1 - y0 ).
+							scaled( ow, oh, Qt::IgnoreAspectRatio,
+										Qt::SmoothTransformation );
+
+	QPainter p( &m_image );
+	p.setCompositionMode( QPainter::CompositionMode_Source );
+	p.drawImage( rect.topLeft(), part, rect.translated( -ox, -oy ) );
+}
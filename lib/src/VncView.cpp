@@ -41,6 +41,9 @@ VncView::VncView( const QString &host, QWidget *parent, Mode mode ) :
 	m_vncConn( new ItalcVncConnection( QCoreApplication::instance() ) ),
 	m_mode( mode ),
 	m_frame(),
+	m_scaledFrame(),
+	m_repaintTimer( this ),
+	m_damagePosition( 0 ),
 	m_cursorShape(),
 	m_cursorX( 0 ),
 	m_cursorY( 0 ),
@@ -72,9 +75,15 @@ VncView::VncView( const QString &host, QWidget *parent, Mode mode ) :
 		m_vncConn->setQuality( ItalcVncConnection::RemoteControlQuality );
 	}
 
-	connect( m_vncConn, SIGNAL( imageUpdated( int, int, int, int ) ),
-			this, SLOT( updateImage( int, int, int, int ) ),
-						Qt::BlockingQueuedConnection );
+	// do not let connection thread wait for us - updated rects are picked
+	// up from m_vncConn->damage() at display rate instead
+	m_repaintTimer.setSingleShot( true );
+	m_repaintTimer.setInterval( RepaintInterval );
+	connect( &m_repaintTimer, SIGNAL( timeout() ),
+				this, SLOT( repaintDamage() ) );
+
+	connect( m_vncConn, SIGNAL( framebufferUpdateComplete() ),
+				this, SLOT( scheduleRepaint() ), Qt::QueuedConnection );
 
 	connect( m_vncConn, SIGNAL( framebufferSizeChanged( int, int ) ),
 				this, SLOT( updateSizeHint( int, int ) ), Qt::QueuedConnection );
@@ -117,8 +126,8 @@ VncView::VncView( const QString &host, QWidget *parent, Mode mode ) :
 
 VncView::~VncView()
 {
-	disconnect( m_vncConn, SIGNAL( imageUpdated( int, int, int, int ) ),
-			this, SLOT( updateImage( int, int, int, int ) ) );
+	disconnect( m_vncConn, SIGNAL( framebufferUpdateComplete() ),
+				this, SLOT( scheduleRepaint() ) );
 
 	unpressModifiers();
 	delete m_sysKeyTrapper;
@@ -604,44 +613,19 @@ void VncView::paintEvent( QPaintEvent *paintEvent )
 	}
 
 	const QSize sSize = scaledSize();
-	const float scale = sSize.isEmpty() ? 1 :
-			(float) sSize.width() / framebufferSize().width();
-	if( m_repaint )
+	const QImage *frame = &m_frame;
+	if( sSize.isEmpty() == false && sSize != m_frame.size() )
 	{
-		if( sSize.isEmpty() )
-		{
-			p.drawImage( QRect( m_x, m_y, m_w, m_h ),
-					m_frame.copy( m_x, m_y, m_w, m_h ) );
-		}
-		else
-		{
-			p.drawImage( 0, 0, m_frame.scaled( sSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation ) );
-		}
+		// scaled frame only has to be re-sampled completely if the size of
+		// the view or of the framebuffer changed
+		m_scaledFrame.update( m_frame, sSize, QRegion() );
+		frame = &m_scaledFrame.image();
 	}
-	else
+
+	foreach( const QRect &rect, paintEvent->region().rects() )
 	{
-		QRect rect = paintEvent->rect();
-		if( rect.width() != m_frame.width() || rect.height() != m_frame.height() )
-		{
-			int sx = qRound( rect.x()/scale );
-			int sy = qRound( rect.y()/scale );
-			int sw = qRound( rect.width()/scale );
-			int sh = qRound( rect.height()/scale );
-			p.drawImage( rect, m_frame.copy( sx, sy, sw, sh ).
-				scaled( rect.width(), rect.height(),
-						Qt::IgnoreAspectRatio,
-						Qt::SmoothTransformation ) );
-		}
-		else
-		{
-			// even we just have to update a part of the screen, update
-			// everything when in scaled mode as otherwise there're annoying
-			// artifacts
-			p.drawImage( QPoint( 0, 0 ),
-		m_frame.scaled( qRound( m_frame.width() * scale ),
-					qRound( m_frame.height()*scale ),
-			Qt::IgnoreAspectRatio, Qt::SmoothTransformation ) );
-		}
+		const QRect r = rect.intersected( frame->rect() );
+		p.drawImage( r.topLeft(), *frame, r );
 	}
 
 	if( isViewOnly() && !m_cursorShape.isNull() )
@@ -761,26 +745,25 @@ void VncView::mouseEventHandler( QMouseEvent * _me )
 
 
 
-void VncView::updateImage(int x, int y, int w, int h)
+void VncView::scheduleRepaint()
 {
-	m_x = x;
-	m_y = y;
-	m_w = w;
-	m_h = h;
-
-	const QSize sSize = scaledSize();
-	const float scale = sSize.isEmpty() ? 1 :
-			(float) sSize.width() / framebufferSize().width();
-	if( !sSize.isEmpty() )
+	// coalesce all updates until next repaint
+	if( m_repaintTimer.isActive() == false )
 	{
-		m_x-=1;
-		m_y-=1;
-		m_w+=2;
-		m_h+=2;
+		m_repaintTimer.start();
 	}
+}
+
+
 
+
+void VncView::repaintDamage()
+{
 	m_frame = m_vncConn->image();
 
+	const QRegion damage =
+		m_vncConn->damage().take( &m_damagePosition, m_frame.rect() );
+
 	if( !m_initDone )
 	{
 		setAttribute( Qt::WA_StaticContents );
@@ -798,10 +781,16 @@ void VncView::updateImage(int x, int y, int w, int h)
 
 	}
 
-	m_repaint = true;
-	repaint( qRound( m_x*scale ), qRound( m_y*scale ),
-			qRound( m_w*scale ), qRound( m_h*scale ) );
-	m_repaint = false;
+	const QSize sSize = scaledSize();
+	if( sSize.isEmpty() || sSize == m_frame.size() )
+	{
+		m_scaledFrame.clear();
+		update( damage );
+	}
+	else
+	{
+		update( m_scaledFrame.update( m_frame, sSize, damage ) );
+	}
 }
 
 